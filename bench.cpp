@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "broadphase.hpp"
+#include "chunkgrid.hpp"
+#include "flowfield.hpp"
+#include "fov.hpp"
+#include "pathfinding.hpp"
+#include "perlin.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+float seconds_since(Clock::time_point start) {
+    return std::chrono::duration<float>(Clock::now() - start).count();
+}
+
+void report(const char* name, double samples, float seconds) {
+    printf("%-32s %8.2f Msamples/s\n", name, samples / seconds / 1e6);
+}
+
+void bench_perlin() {
+    const int w = 1024;
+    const int h = 1024;
+    const int repeat = 10;
+    float* out = (float*)malloc(w * h * sizeof(float));
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < repeat; ++i) {
+        float* grid = create_perlin_grid(w, h, 0.05, 1);
+        free(grid);
+    }
+    report("perlin scalar, 1 octave", (double)w * h * repeat, seconds_since(start));
+
+    FbmType types[] = {FBM_STANDARD, FBM_RIDGED, FBM_TURBULENCE};
+    const char* names[] = {"fbm standard", "fbm ridged", "fbm turbulence"};
+    int octave_counts[] = {1, 6};
+    for (int octaves : octave_counts) {
+        for (int t = 0; t < 3; ++t) {
+            FbmParams params = {.type = types[t], .octaves = octaves, .frequency = 0.05};
+            start = Clock::now();
+            for (int i = 0; i < repeat; ++i) {
+                fbm_fill(out, w, h, 0, 0, params);
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %d octave%s", names[t], octaves, octaves > 1 ? "s" : "");
+            // One sample per octave, comparable with the single octave scalar version
+            report(name, (double)w * h * repeat * octaves, seconds_since(start));
+        }
+    }
+
+    free(out);
+}
+
+void bench_simplex() {
+    const int w = 1024;
+    const int h = 1024;
+    const int repeat = 10;
+    float* out = (float*)malloc(w * sizeof(float));
+    Vec3* gradient = (Vec3*)malloc(w * sizeof(Vec3));
+
+    Clock::time_point start = Clock::now();
+    float sum = 0;
+    for (int i = 0; i < repeat; ++i)
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                sum += simplex_noise2(1, x * 0.05f, y * 0.05f, NULL);
+            }
+    report("simplex 2d scalar", (double)w * h * repeat, seconds_since(start));
+
+    start = Clock::now();
+    for (int i = 0; i < repeat; ++i)
+        for (int y = 0; y < h; ++y) {
+            simplex2_row(out, NULL, w, 0, y, 0.05, 1);
+            sum += out[0];
+        }
+    report("simplex 2d rows", (double)w * h * repeat, seconds_since(start));
+
+    start = Clock::now();
+    for (int i = 0; i < repeat; ++i)
+        for (int y = 0; y < h; ++y) {
+            simplex3_row(out, gradient, w, 0, y, i, 0.05, 1);
+            sum += out[0];
+        }
+    report("simplex 3d rows + derivatives", (double)w * h * repeat, seconds_since(start));
+
+    // Keeps the scalar loop from being optimized away
+    if (sum == 12345) printf("\n");
+
+    free(out);
+    free(gradient);
+}
+
+// Generates the same region in tiles from several threads and checks it matches the serial result
+void bench_perlin_parallel() {
+    const int w = 2048;
+    const int h = 2048;
+    const int tile = 256;
+    const int n_threads = 4;
+    FbmParams params = {.octaves = 6, .frequency = 0.01, .seed = 1234};
+    float* serial = (float*)malloc(w * h * sizeof(float));
+    float* tiled = (float*)malloc(w * h * sizeof(float));
+
+    Clock::time_point start = Clock::now();
+    fbm_fill(serial, w, h, 0, 0, params);
+    report("fbm 6 octaves, serial", (double)w * h * params.octaves, seconds_since(start));
+
+    start = Clock::now();
+    std::thread threads[n_threads];
+    for (int t = 0; t < n_threads; ++t) {
+        threads[t] = std::thread([=]() {
+            float* buffer = (float*)malloc(tile * tile * sizeof(float));
+            int n_tiles = (w / tile) * (h / tile);
+            for (int i = t; i < n_tiles; i += n_threads) {
+                int tx = (i % (w / tile)) * tile;
+                int ty = (i / (w / tile)) * tile;
+                fbm_fill(buffer, tile, tile, tx, ty, params);
+                for (int y = 0; y < tile; ++y) {
+                    memcpy(tiled + (ty + y) * w + tx, buffer + y * tile, tile * sizeof(float));
+                }
+            }
+            free(buffer);
+        });
+    }
+    for (int t = 0; t < n_threads; ++t) threads[t].join();
+    report("fbm 6 octaves, 4 threads tiled", (double)w * h * params.octaves, seconds_since(start));
+    printf("tiled matches serial: %s\n", memcmp(serial, tiled, w * h * sizeof(float)) == 0 ? "yes" : "NO");
+
+    free(serial);
+    free(tiled);
+}
+
+int brute_force_pairs(Circle* circles, int n) {
+    int n_pairs = 0;
+    for (int a = 0; a < n; ++a)
+        for (int b = a + 1; b < n; ++b) {
+            float min_distance = circles[a].radius + circles[b].radius;
+            Vec2 ab = circles[b].center - circles[a].center;
+            if (vec2_dot(ab, ab) < min_distance * min_distance) n_pairs++;
+        }
+    return n_pairs;
+}
+
+// Circles of radius 1 to 2 at constant density, about as crowded as a forest
+void bench_broadphase() {
+    Broadphase bp;
+    int counts[] = {1000, 10000, 100000};
+    for (int n : counts) {
+        Circle* circles = (Circle*)malloc(n * sizeof(Circle));
+        float side = sqrtf(n * 30.f);
+        srand(n);
+        for (int i = 0; i < n; ++i) {
+            circles[i] = {{(float)rand() / RAND_MAX * side, (float)rand() / RAND_MAX * side},
+                          1 + (float)rand() / RAND_MAX};
+        }
+
+        const int repeat = 20;
+        int n_pairs = 0;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < repeat; ++i) n_pairs = broadphase_find_pairs(&bp, circles, n);
+        float grid_ms = seconds_since(start) * 1000 / repeat;
+        printf("broadphase %6d circles: %8.3f ms, %d pairs", n, grid_ms, n_pairs);
+
+        if (n <= 10000) {
+            start = Clock::now();
+            int brute_pairs = brute_force_pairs(circles, n);
+            printf(", all pairs %8.3f ms (%s)", seconds_since(start) * 1000,
+                   brute_pairs == n_pairs ? "same" : "DIFFERENT");
+        }
+        printf("\n");
+
+        free(circles);
+    }
+    broadphase_destroy(&bp);
+}
+
+// Length of the shortest path by Dijkstra over the whole grid, INFINITY if there is none
+float grid_path_length(const PathGrid* g, PathCell start, PathCell goal, float* dist, PathHeapEntry* heap) {
+    for (int i = 0; i < g->w * g->h; ++i) dist[i] = INFINITY;
+    int n = 0;
+    auto push = [&](float f, int id) {
+        int i = n++;
+        for (; i > 0 && heap[(i - 1) / 2].f > f; i = (i - 1) / 2) heap[i] = heap[(i - 1) / 2];
+        heap[i] = {f, id};
+    };
+    dist[start.y * g->w + start.x] = 0;
+    push(0, start.y * g->w + start.x);
+    while (n > 0) {
+        PathHeapEntry e = heap[0];
+        PathHeapEntry last = heap[--n];
+        int i = 0;
+        for (int child = 1; child < n; child = 2 * i + 1) {
+            if (child + 1 < n && heap[child + 1].f < heap[child].f) child++;
+            if (last.f <= heap[child].f) break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = last;
+
+        if (e.f > dist[e.id]) continue;
+        int x = e.id % g->w;
+        int y = e.id / g->w;
+        if (x == goal.x && y == goal.y) return e.f;
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx) {
+                if ((dx == 0 && dy == 0) || !path_walkable(g, x + dx, y + dy)) continue;
+                if (dx != 0 && dy != 0 && (!path_walkable(g, x + dx, y) || !path_walkable(g, x, y + dy))) continue;
+                float d = e.f + (dx != 0 && dy != 0 ? 1.41421356f : 1);
+                int ni = (y + dy) * g->w + x + dx;
+                if (d < dist[ni]) {
+                    dist[ni] = d;
+                    push(d, ni);
+                }
+            }
+    }
+    return INFINITY;
+}
+
+// Lakes from thresholded fbm, cells are 1 under water
+uint8_t* make_lakes(int w, int h, int* n_open) {
+    float* height = (float*)malloc(w * h * sizeof(float));
+    uint8_t* cells = (uint8_t*)malloc(w * h);
+    FbmParams params = {.octaves = 5, .frequency = 0.01, .seed = 7};
+    fbm_fill(height, w, h, 0, 0, params);
+    *n_open = 0;
+    for (int i = 0; i < w * h; ++i) {
+        cells[i] = height[i] < -0.15f;
+        *n_open += !cells[i];
+    }
+    free(height);
+    return cells;
+}
+
+// 1000 x 1000, about the size of the world's ground
+void bench_pathfinding() {
+    const int w = 1000;
+    const int h = 1000;
+    int n_open;
+    uint8_t* cells = make_lakes(w, h, &n_open);
+    PathGrid grid = {w, h, cells, 1 << 1};
+
+    Hpa hpa;
+    Clock::time_point start = Clock::now();
+    hpa_build(&hpa, grid);
+    printf("hpa build %dx%d (%.0f%% open): %8.3f ms, %d nodes\n", w, h, 100.f * n_open / (w * h),
+           seconds_since(start) * 1000, hpa.n_nodes);
+
+    const int n_queries = 2000;
+    PathCell* queries = (PathCell*)malloc(2 * n_queries * sizeof(PathCell));
+    srand(46);
+    for (int i = 0; i < 2 * n_queries; ++i) {
+        do {
+            queries[i] = {rand() % w, rand() % h};
+        } while (!path_walkable(&grid, queries[i].x, queries[i].y));
+    }
+
+    const int capacity = 16384;
+    PathCell* path = (PathCell*)malloc(capacity * sizeof(PathCell));
+    int n_found = 0;
+    long total_cells = 0;
+    start = Clock::now();
+    for (int i = 0; i < n_queries; ++i) {
+        int n = hpa_find_path(&hpa, queries[2 * i], queries[2 * i + 1], path, capacity);
+        if (n >= 0) {
+            n_found++;
+            total_cells += n;
+        }
+    }
+    float seconds = seconds_since(start);
+    printf("hpa find path: %8.0f queries/s, %d of %d found, %.0f cells on average\n", n_queries / seconds,
+           n_found, n_queries, (float)total_cells / (n_found ? n_found : 1));
+
+    // Compare a few against the optimal path over the full grid
+    float* dist = (float*)malloc(w * h * sizeof(float));
+    PathHeapEntry* heap = (PathHeapEntry*)malloc(8 * w * h * sizeof(PathHeapEntry));
+    const int n_checked = 20;
+    int n_mismatch = 0;
+    int n_invalid = 0;
+    float hpa_total = 0;
+    float optimal_total = 0;
+    float grid_seconds = 0;
+    for (int i = 0; i < n_checked; ++i) {
+        int n = hpa_find_path(&hpa, queries[2 * i], queries[2 * i + 1], path, capacity);
+        start = Clock::now();
+        float optimal = grid_path_length(&grid, queries[2 * i], queries[2 * i + 1], dist, heap);
+        grid_seconds += seconds_since(start);
+        if ((n >= 0) != (optimal < INFINITY)) n_mismatch++;
+        if (n < 0 || n > capacity) continue;
+
+        float length = 0;
+        for (int k = 1; k < n; ++k) {
+            int dx = path[k].x - path[k - 1].x;
+            int dy = path[k].y - path[k - 1].y;
+            bool ok = abs(dx) <= 1 && abs(dy) <= 1 && (dx || dy) && path_walkable(&grid, path[k].x, path[k].y) &&
+                      (!dx || !dy || (path_walkable(&grid, path[k - 1].x + dx, path[k - 1].y) &&
+                                      path_walkable(&grid, path[k - 1].x, path[k - 1].y + dy)));
+            n_invalid += !ok;
+            length += dx && dy ? 1.41421356f : 1;
+        }
+        hpa_total += length;
+        optimal_total += optimal;
+    }
+    printf("grid dijkstra: %8.0f queries/s, hpa paths %.1f%% longer, %d reachability mismatches, %d bad steps\n",
+           n_checked / grid_seconds, 100 * (hpa_total / optimal_total - 1), n_mismatch, n_invalid);
+
+    // A lake appears, as when the ground is extended
+    for (int y = 480; y < 520; ++y)
+        for (int x = 480; x < 520; ++x) cells[y * w + x] = 1;
+    start = Clock::now();
+    hpa_repair(&hpa, 480, 480, 520, 520);
+    printf("hpa repair 40x40 cells: %8.3f ms\n", seconds_since(start) * 1000);
+
+    hpa_destroy(&hpa);
+    free(heap);
+    free(dist);
+    free(path);
+    free(queries);
+    free(cells);
+}
+
+void bench_flow_field() {
+    const int w = 1000;
+    const int h = 1000;
+    int n_open;
+    uint8_t* cells = make_lakes(w, h, &n_open);
+    PathGrid grid = {w, h, cells, 1 << 1};
+    PathCell target = {w / 2, h / 2};
+    while (!path_walkable(&grid, target.x, target.y)) target.x++;
+
+    PathHeapEntry* heap = NULL;
+    int heap_capacity = 0;
+    int radii[] = {32, 96, 500};
+    for (int radius : radii) {
+        FlowField f = flow_field_create(radius);
+        const int repeat = radius > 100 ? 2 : 20;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < repeat; ++i) flow_field_compute(&f, &grid, target, &heap, &heap_capacity);
+        printf("flow field radius %3d: %8.3f ms\n", radius, seconds_since(start) * 1000 / repeat);
+
+        // Agents anywhere in the window
+        if (radius == 96) {
+            const int n_agents = 1 << 20;
+            srand(47);
+            Vec2* agents = (Vec2*)malloc(n_agents * sizeof(Vec2));
+            for (int i = 0; i < n_agents; ++i) {
+                agents[i] = {f.x0 + (float)rand() / RAND_MAX * f.size, f.y0 + (float)rand() / RAND_MAX * f.size};
+            }
+            int n_stuck = 0;
+            start = Clock::now();
+            for (int i = 0; i < n_agents; ++i) n_stuck += is_zero(flow_field_sample(&f, agents[i]));
+            report("flow field samples", n_agents, seconds_since(start));
+            printf("flow field: %.1f%% of agents in water or cut off\n", 100.f * n_stuck / n_agents);
+            free(agents);
+        }
+        flow_field_destroy(&f);
+    }
+    free(heap);
+    free(cells);
+}
+
+// Lakes stand in for walls. Each step either moves the viewer, recasting everything, or moves a
+// few occluders, recasting the octants they are in.
+void bench_fov() {
+    const int w = 1000;
+    const int h = 1000;
+    int n_open;
+    uint8_t* walls = make_lakes(w, h, &n_open);
+    PathCell origin = {w / 2, h / 2};
+    while (walls[origin.y * w + origin.x]) origin.x++;
+
+    int radii[] = {20, 40, 80};
+    for (int radius : radii) {
+        Fov f = fov_create(w, h, radius, walls);
+        const int repeat = 1000;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < repeat; ++i) fov_update(&f, {origin.x + (i & 1), origin.y});
+        float full_ms = seconds_since(start) * 1000 / repeat;
+
+        // Back at the origin, so only the occluders recast below
+        fov_update(&f, origin);
+        srand(48);
+        PathCell movers[4];
+        start = Clock::now();
+        for (int i = 0; i < repeat; ++i) {
+            for (PathCell& m : movers) m = {origin.x + rand() % radius - radius / 2, origin.y + rand() % radius - radius / 2};
+            fov_set_movers(&f, movers, 4);
+            fov_update(&f, origin);
+        }
+        float movers_ms = seconds_since(start) * 1000 / repeat;
+        printf("fov radius %2d: viewer moves %7.3f ms, 4 occluders move %7.3f ms\n", radius, full_ms, movers_ms);
+        fov_destroy(&f);
+    }
+    free(walls);
+}
+
+// Lakes over a large map: the same sum over all cells read densely, through chunk rows and cell by
+// cell, and the memory each takes
+void bench_chunk_grid() {
+    const int w = 4096;
+    const int h = 4096;
+    int n_open;
+    uint8_t* dense = make_lakes(w, h, &n_open);
+    ChunkGrid g = chunk_grid_create(w, h, 0);
+    chunk_grid_write(&g, 0, 0, w, h, dense, w);
+
+    const int repeat = 10;
+    long sum_dense = 0, sum_rows = 0, sum_get = 0;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < repeat; ++r)
+        for (int i = 0; i < w * h; ++i) sum_dense += dense[i];
+    float dense_s = seconds_since(start);
+
+    start = Clock::now();
+    for (int r = 0; r < repeat; ++r)
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w;) {
+                int end = chunk_grid_run_end(x, w);
+                const uint8_t* row = chunk_grid_row(&g, x, y);
+                for (int k = 0; k < end - x; ++k) sum_rows += row[k];
+                x = end;
+            }
+    float rows_s = seconds_since(start);
+
+    start = Clock::now();
+    for (int r = 0; r < repeat; ++r)
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) sum_get += chunk_grid_get(&g, x, y);
+    float get_s = seconds_since(start);
+
+    if (sum_rows != sum_dense || sum_get != sum_dense) printf("chunk grid: sums differ\n");
+    report("chunk grid, dense array", (double)repeat * w * h, dense_s);
+    report("chunk grid, chunk rows", (double)repeat * w * h, rows_s);
+    report("chunk grid, get per cell", (double)repeat * w * h, get_s);
+    printf("chunk grid %dx%d: %d of %d chunks allocated, %zu KB (dense %d KB)\n", w, h, g.n_allocated,
+           g.chunks_x * g.chunks_y, chunk_grid_bytes(&g) / 1024, w * h / 1024);
+    chunk_grid_destroy(&g);
+    free(dense);
+
+    ChunkGrid big = chunk_grid_create(16384, 16384, 1);
+    printf("chunk grid 16384x16384 uniform: %zu KB (dense %d KB)\n", chunk_grid_bytes(&big) / 1024, 16384 * 16384 / 1024);
+    chunk_grid_destroy(&big);
+}
+
+int main(int argc, char** argv) {
+    bench_perlin();
+    bench_perlin_parallel();
+    bench_simplex();
+    bench_broadphase();
+    bench_pathfinding();
+    bench_flow_field();
+    bench_fov();
+    bench_chunk_grid();
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "broadphase.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+void broadphase_destroy(Broadphase* bp) {
+    free(bp->bucket_start);
+    free(bp->entries);
+    free(bp->cell_x);
+    free(bp->cell_y);
+    free(bp->bucket);
+    free(bp->pairs);
+    *bp = {};
+}
+
+static void broadphase_reserve(Broadphase* bp, int n) {
+    if (n <= bp->capacity) return;
+
+    bp->capacity = n;
+    // Power of two at least twice the count keeps buckets short
+    bp->table_size = 1;
+    while (bp->table_size < 2 * n) bp->table_size *= 2;
+    bp->bucket_start = (int*)realloc(bp->bucket_start, (bp->table_size + 1) * sizeof(int));
+    bp->entries = (int*)realloc(bp->entries, n * sizeof(int));
+    bp->cell_x = (int*)realloc(bp->cell_x, n * sizeof(int));
+    bp->cell_y = (int*)realloc(bp->cell_y, n * sizeof(int));
+    bp->bucket = (int*)realloc(bp->bucket, n * sizeof(int));
+}
+
+static void broadphase_push_pair(Broadphase* bp, int a, int b) {
+    if (bp->n_pairs == bp->pairs_capacity) {
+        bp->pairs_capacity = bp->pairs_capacity ? 2 * bp->pairs_capacity : 256;
+        bp->pairs = (CollisionPair*)realloc(bp->pairs, bp->pairs_capacity * sizeof(CollisionPair));
+    }
+    bp->pairs[bp->n_pairs++] = {a, b};
+}
+
+static int cell_hash(int x, int y, int table_size) {
+    uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u;
+    h ^= h >> 16;
+    return h & (table_size - 1);
+}
+
+int broadphase_find_pairs(Broadphase* bp, Circle* circles, int n) {
+    bp->n_pairs = 0;
+    if (n == 0) return 0;
+
+    broadphase_reserve(bp, n);
+
+    float max_radius = 0;
+    for (int i = 0; i < n; ++i) max_radius = fmaxf(max_radius, circles[i].radius);
+    float inv_cell_size = 1.f / fmaxf(2 * max_radius, 1e-6f);
+
+    // Counting sort of the circles by bucket
+    for (int k = 0; k <= bp->table_size; ++k) bp->bucket_start[k] = 0;
+    for (int i = 0; i < n; ++i) {
+        bp->cell_x[i] = (int)floorf(circles[i].center.x * inv_cell_size);
+        bp->cell_y[i] = (int)floorf(circles[i].center.y * inv_cell_size);
+        bp->bucket[i] = cell_hash(bp->cell_x[i], bp->cell_y[i], bp->table_size);
+        bp->bucket_start[bp->bucket[i] + 1]++;
+    }
+    for (int k = 0; k < bp->table_size; ++k) bp->bucket_start[k + 1] += bp->bucket_start[k];
+    for (int i = 0; i < n; ++i) bp->entries[bp->bucket_start[bp->bucket[i]]++] = i;
+    // Filling shifted every start to the next bucket's, shift back
+    for (int k = bp->table_size; k > 0; --k) bp->bucket_start[k] = bp->bucket_start[k - 1];
+    bp->bucket_start[0] = 0;
+
+    for (int a = 0; a < n; ++a) {
+        int first = bp->n_pairs;
+        Circle ca = circles[a];
+
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx) {
+                int cx = bp->cell_x[a] + dx;
+                int cy = bp->cell_y[a] + dy;
+                int k = cell_hash(cx, cy, bp->table_size);
+                for (int j = bp->bucket_start[k]; j < bp->bucket_start[k + 1]; ++j) {
+                    int b = bp->entries[j];
+                    if (b <= a) continue;
+                    // Different cells can share a bucket, only take the ones really in this cell
+                    if (bp->cell_x[b] != cx || bp->cell_y[b] != cy) continue;
+
+                    float min_distance = ca.radius + circles[b].radius;
+                    Vec2 ab = circles[b].center - ca.center;
+                    if (vec2_dot(ab, ab) < min_distance * min_distance) broadphase_push_pair(bp, a, b);
+                }
+            }
+
+        // Pairs of `a` are few, insertion sort them by b
+        for (int i = first + 1; i < bp->n_pairs; ++i) {
+            CollisionPair p = bp->pairs[i];
+            int j = i;
+            while (j > first && bp->pairs[j - 1].b > p.b) {
+                bp->pairs[j] = bp->pairs[j - 1];
+                j--;
+            }
+            bp->pairs[j] = p;
+        }
+    }
+
+    return bp->n_pairs;
+}
@@ -0,0 +1,33 @@
+#ifndef BROADPHASE_HPP
+#define BROADPHASE_HPP
+
+#include "visibility.hpp"
+
+struct CollisionPair {
+    int a;  // a < b
+    int b;
+};
+
+// Uniform hash grid with cells as large as the biggest circle, so overlapping circles are always in
+// the same or adjacent cells. Buffers grow as needed and are reused between frames.
+struct Broadphase {
+    int capacity = 0;
+    int table_size = 0;
+    int* bucket_start = NULL;  // table_size + 1, entries of bucket k are entries[bucket_start[k]..]
+    int* entries = NULL;
+    int* cell_x = NULL;
+    int* cell_y = NULL;
+    int* bucket = NULL;
+
+    int pairs_capacity = 0;
+    int n_pairs = 0;
+    CollisionPair* pairs = NULL;
+};
+
+void broadphase_destroy(Broadphase* bp);
+
+// Finds every pair of overlapping circles. Pairs come out sorted by (a, b), the same order as a
+// nested loop over all pairs, so resolving them in order is deterministic.
+int broadphase_find_pairs(Broadphase* bp, Circle* circles, int n);
+
+#endif /* BROADPHASE_HPP */
@@ -0,0 +1,153 @@
+#include "chunkgrid.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+const int chunk_cells = chunk_size * chunk_size;
+
+// A chunk row of each value, what chunk_grid_row returns for uniform chunks
+static struct UniformRows {
+    uint8_t row[256][chunk_size];
+    UniformRows() {
+        for (int v = 0; v < 256; ++v) memset(row[v], v, chunk_size);
+    }
+} uniform_rows;
+
+ChunkGrid chunk_grid_create(int w, int h, uint8_t value) {
+    int chunks_x = (w + chunk_size - 1) / chunk_size;
+    int chunks_y = (h + chunk_size - 1) / chunk_size;
+    ChunkGrid g = {
+        .w = w,
+        .h = h,
+        .chunks_x = chunks_x,
+        .chunks_y = chunks_y,
+        .cells = (uint8_t**)calloc(chunks_x * chunks_y, sizeof(uint8_t*)),
+        .uniform = (uint8_t*)malloc(chunks_x * chunks_y),
+        .n_allocated = 0,
+    };
+    memset(g.uniform, value, chunks_x * chunks_y);
+    return g;
+}
+
+void chunk_grid_destroy(ChunkGrid* g) {
+    if (!g->cells) return;
+    for (int c = 0; c < g->chunks_x * g->chunks_y; ++c) free(g->cells[c]);
+    free(g->cells);
+    free(g->uniform);
+    *g = {};
+}
+
+static uint8_t* chunk_cells_of(ChunkGrid* g, int c) {
+    if (!g->cells[c]) {
+        g->cells[c] = (uint8_t*)malloc(chunk_cells);
+        memset(g->cells[c], g->uniform[c], chunk_cells);
+        g->n_allocated++;
+    }
+    return g->cells[c];
+}
+
+const uint8_t* chunk_grid_row(const ChunkGrid* g, int x, int y) {
+    int c = chunk_grid_chunk(g, x, y);
+    const uint8_t* cells = g->cells[c];
+    if (!cells) return uniform_rows.row[g->uniform[c]] + (x & chunk_mask);
+    return cells + (y & chunk_mask) * chunk_size + (x & chunk_mask);
+}
+
+uint8_t* chunk_grid_row_write(ChunkGrid* g, int x, int y) {
+    uint8_t* cells = chunk_cells_of(g, chunk_grid_chunk(g, x, y));
+    return cells + (y & chunk_mask) * chunk_size + (x & chunk_mask);
+}
+
+void chunk_grid_set(ChunkGrid* g, int x, int y, uint8_t value) {
+    int c = chunk_grid_chunk(g, x, y);
+    if (!g->cells[c] && g->uniform[c] == value) return;
+    chunk_cells_of(g, c)[(y & chunk_mask) * chunk_size + (x & chunk_mask)] = value;
+}
+
+// Only the cells inside the grid count, the rest of an edge chunk is never written
+static void chunk_compact(ChunkGrid* g, int c) {
+    uint8_t* cells = g->cells[c];
+    if (!cells) return;
+    int w = g->w - (c % g->chunks_x) * chunk_size;
+    int h = g->h - (c / g->chunks_x) * chunk_size;
+    w = w < chunk_size ? w : chunk_size;
+    h = h < chunk_size ? h : chunk_size;
+    uint8_t value = cells[0];
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x) {
+            if (cells[y * chunk_size + x] != value) return;
+        }
+    free(cells);
+    g->cells[c] = NULL;
+    g->uniform[c] = value;
+    g->n_allocated--;
+}
+
+void chunk_grid_compact(ChunkGrid* g, int x0, int y0, int x1, int y1) {
+    if (x1 <= x0 || y1 <= y0) return;
+    for (int cy = y0 >> chunk_shift; cy <= (y1 - 1) >> chunk_shift; ++cy)
+        for (int cx = x0 >> chunk_shift; cx <= (x1 - 1) >> chunk_shift; ++cx) {
+            chunk_compact(g, cy * g->chunks_x + cx);
+        }
+}
+
+void chunk_grid_read(const ChunkGrid* g, int x0, int y0, int x1, int y1, uint8_t* out, int stride) {
+    for (int y = y0; y < y1; ++y) {
+        uint8_t* row = out + (y - y0) * stride;
+        for (int x = x0; x < x1;) {
+            int end = chunk_grid_run_end(x, x1);
+            memcpy(row + (x - x0), chunk_grid_row(g, x, y), end - x);
+            x = end;
+        }
+    }
+}
+
+void chunk_grid_write(ChunkGrid* g, int x0, int y0, int x1, int y1, const uint8_t* in, int stride) {
+    if (x1 <= x0 || y1 <= y0) return;
+    for (int cy = y0 >> chunk_shift; cy <= (y1 - 1) >> chunk_shift; ++cy)
+        for (int cx = x0 >> chunk_shift; cx <= (x1 - 1) >> chunk_shift; ++cx) {
+            int c = cy * g->chunks_x + cx;
+            // Overlap of the region and the chunk
+            int ox0 = x0 > cx * chunk_size ? x0 : cx * chunk_size;
+            int oy0 = y0 > cy * chunk_size ? y0 : cy * chunk_size;
+            int ox1 = x1 < (cx + 1) * chunk_size ? x1 : (cx + 1) * chunk_size;
+            int oy1 = y1 < (cy + 1) * chunk_size ? y1 : (cy + 1) * chunk_size;
+
+            if (!g->cells[c]) {
+                bool same = true;
+                for (int y = oy0; y < oy1 && same; ++y) {
+                    const uint8_t* row = in + (y - y0) * stride + (ox0 - x0);
+                    for (int x = 0; x < ox1 - ox0; ++x) same &= row[x] == g->uniform[c];
+                }
+                if (same) continue;
+            }
+            uint8_t* cells = chunk_cells_of(g, c);
+            for (int y = oy0; y < oy1; ++y) {
+                memcpy(cells + (y & chunk_mask) * chunk_size + (ox0 & chunk_mask), in + (y - y0) * stride + (ox0 - x0),
+                       ox1 - ox0);
+            }
+            chunk_compact(g, c);
+        }
+}
+
+void chunk_grid_load_chunk(ChunkGrid* g, int c, const uint8_t* cells) {
+    memcpy(chunk_cells_of(g, c), cells, chunk_cells);
+}
+
+void chunk_grid_copy_chunk(ChunkGrid* dst, const ChunkGrid* src, int c) {
+    if (!src->cells[c]) {
+        if (dst->cells[c]) {
+            free(dst->cells[c]);
+            dst->cells[c] = NULL;
+            dst->n_allocated--;
+        }
+        dst->uniform[c] = src->uniform[c];
+        return;
+    }
+    chunk_grid_load_chunk(dst, c, src->cells[c]);
+}
+
+size_t chunk_grid_bytes(const ChunkGrid* g) {
+    size_t n_chunks = g->chunks_x * g->chunks_y;
+    return n_chunks * (sizeof(uint8_t*) + 1) + (size_t)g->n_allocated * chunk_cells;
+}
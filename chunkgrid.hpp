@@ -0,0 +1,69 @@
+#ifndef CHUNKGRID_HPP
+#define CHUNKGRID_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A byte per cell over a grid of square chunks. A chunk holds a single value until a cell is set
+// to anything else, and only then gets its cells, so a large world of mostly one material costs a
+// byte per chunk. Each chunk row is contiguous: loops over a region go row by row and chunk by
+// chunk through chunk_grid_row, not cell by cell through chunk_grid_get.
+const int chunk_shift = 6;
+const int chunk_size = 1 << chunk_shift;
+const int chunk_mask = chunk_size - 1;
+
+struct ChunkGrid {
+    int w;
+    int h;
+    int chunks_x;
+    int chunks_y;
+    uint8_t** cells;   // per chunk, chunk_size * chunk_size, NULL while uniform
+    uint8_t* uniform;  // per chunk, the value of all its cells while uniform
+    int n_allocated;
+};
+
+ChunkGrid chunk_grid_create(int w, int h, uint8_t value);
+void chunk_grid_destroy(ChunkGrid* g);
+
+inline int chunk_grid_chunk(const ChunkGrid* g, int x, int y) {
+    return (y >> chunk_shift) * g->chunks_x + (x >> chunk_shift);
+}
+
+inline uint8_t chunk_grid_get(const ChunkGrid* g, int x, int y) {
+    int c = chunk_grid_chunk(g, x, y);
+    const uint8_t* cells = g->cells[c];
+    return cells ? cells[(y & chunk_mask) * chunk_size + (x & chunk_mask)] : g->uniform[c];
+}
+
+// End of the run of cells from x within the same chunk row, at most x1
+inline int chunk_grid_run_end(int x, int x1) {
+    int end = (x | chunk_mask) + 1;
+    return end < x1 ? end : x1;
+}
+
+// Cells from (x, y) to the end of its chunk row. Uniform chunks point at a shared row of their
+// value, which must not be written.
+const uint8_t* chunk_grid_row(const ChunkGrid* g, int x, int y);
+
+// Same, writable, giving the chunk its cells if it doesn't have them yet
+uint8_t* chunk_grid_row_write(ChunkGrid* g, int x, int y);
+
+void chunk_grid_set(ChunkGrid* g, int x, int y, uint8_t value);
+
+// Frees the cells of the chunks overlapping [x0, x1) x [y0, y1) that are all the same again
+void chunk_grid_compact(ChunkGrid* g, int x0, int y0, int x1, int y1);
+
+// Copies [x0, x1) x [y0, y1) to and from a dense array of `stride` bytes per row. Writing only
+// allocates chunks that stop being uniform, and compacts the ones it touched.
+void chunk_grid_read(const ChunkGrid* g, int x0, int y0, int x1, int y1, uint8_t* out, int stride);
+void chunk_grid_write(ChunkGrid* g, int x0, int y0, int x1, int y1, const uint8_t* in, int stride);
+
+// Gives chunk c its cells, chunk_size * chunk_size copied from `cells`
+void chunk_grid_load_chunk(ChunkGrid* g, int c, const uint8_t* cells);
+
+// Copies chunk c of src, grids of the same size
+void chunk_grid_copy_chunk(ChunkGrid* dst, const ChunkGrid* src, int c);
+
+size_t chunk_grid_bytes(const ChunkGrid* g);
+
+#endif /* CHUNKGRID_HPP */
@@ -0,0 +1,57 @@
+#include "entity.hpp"
+
+#include <stdlib.h>
+
+void entity_slots_destroy(EntitySlots* s) {
+    free(s->generation);
+    free(s->dense);
+    free(s->slot);
+    free(s->next_free);
+    *s = {};
+}
+
+static void entity_slots_grow(EntitySlots* s) {
+    int capacity = s->capacity ? 2 * s->capacity : 64;
+    s->generation = (uint32_t*)realloc(s->generation, capacity * sizeof(uint32_t));
+    s->dense = (int*)realloc(s->dense, capacity * sizeof(int));
+    s->slot = (int*)realloc(s->slot, capacity * sizeof(int));
+    s->next_free = (int*)realloc(s->next_free, capacity * sizeof(int));
+
+    // New slots go on the free list in increasing order
+    for (int i = capacity - 1; i >= s->capacity; --i) {
+        s->generation[i] = 1;
+        s->dense[i] = -1;
+        s->next_free[i] = s->free_head;
+        s->free_head = i;
+    }
+    s->capacity = capacity;
+}
+
+Entity entity_create(EntitySlots* s) {
+    if (s->free_head < 0) entity_slots_grow(s);
+
+    int slot = s->free_head;
+    s->free_head = s->next_free[slot];
+    s->dense[slot] = s->n;
+    s->slot[s->n] = slot;
+    s->n++;
+    return {(uint32_t)slot, s->generation[slot]};
+}
+
+int entity_destroy(EntitySlots* s, Entity e) {
+    int index = entity_index(s, e);
+    if (index < 0) return -1;
+
+    // Swap-remove: the last live entity takes the freed dense index
+    int last = s->n - 1;
+    int last_slot = s->slot[last];
+    s->slot[index] = last_slot;
+    s->dense[last_slot] = index;
+    s->n--;
+
+    s->dense[e.slot] = -1;
+    s->generation[e.slot]++;
+    s->next_free[e.slot] = s->free_head;
+    s->free_head = e.slot;
+    return index;
+}
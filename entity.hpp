@@ -0,0 +1,46 @@
+#ifndef ENTITY_HPP
+#define ENTITY_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Handle to an entity. The generation changes each time a slot is reused, so a handle to a
+// destroyed entity never points at the one that replaced it. Generations start at 1, so a default
+// Entity{} is never alive.
+struct Entity {
+    uint32_t slot = 0;
+    uint32_t generation = 0;
+};
+
+// Maps stable handles to dense indices. Live entities are packed in [0, n): components are stored
+// in parallel arrays indexed by the dense index, and destroying one moves the last entity into its
+// place. Free slots are kept in a linked list and everything grows on demand.
+struct EntitySlots {
+    int n = 0;
+    int capacity = 0;
+    uint32_t* generation = NULL;  // per slot
+    int* dense = NULL;            // per slot, -1 when free
+    int* slot = NULL;             // per dense index
+    int* next_free = NULL;        // per slot
+    int free_head = -1;
+};
+
+void entity_slots_destroy(EntitySlots* s);
+
+// The new entity has dense index s->n - 1. Capacity may grow, check it before writing components.
+Entity entity_create(EntitySlots* s);
+
+// Returns the dense index that was freed: the caller copies its component at s->n (the old last
+// entity, after the call) into it. Returns -1 if the handle is stale.
+int entity_destroy(EntitySlots* s, Entity e);
+
+inline int entity_index(EntitySlots* s, Entity e) {
+    if ((int)e.slot >= s->capacity || s->generation[e.slot] != e.generation) return -1;
+    return s->dense[e.slot];
+}
+
+inline bool entity_alive(EntitySlots* s, Entity e) {
+    return entity_index(s, e) >= 0;
+}
+
+#endif /* ENTITY_HPP */
@@ -0,0 +1,175 @@
+#include "flowfield.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const int flow_dx[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int flow_dy[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+const Vec2 flow_directions[9] = {
+    {1, 0}, {0.70710678f, 0.70710678f}, {0, 1}, {-0.70710678f, 0.70710678f},
+    {-1, 0}, {-0.70710678f, -0.70710678f}, {0, -1}, {0.70710678f, -0.70710678f},
+    {0, 0},
+};
+
+FlowField flow_field_create(int radius) {
+    int size = 2 * radius + 1;
+    return {
+        .size = size,
+        .valid = false,
+        .cost = (float*)malloc(size * size * sizeof(float)),
+        .dir = (uint8_t*)malloc(size * size),
+    };
+}
+
+void flow_field_destroy(FlowField* f) {
+    free(f->cost);
+    free(f->dir);
+}
+
+// Grid move from (x, y) in direction d, diagonals can't cut the corner of a blocked cell
+static bool flow_can_move(const PathGrid* g, int x, int y, int d) {
+    int nx = x + flow_dx[d];
+    int ny = y + flow_dy[d];
+    if (!path_walkable(g, nx, ny)) return false;
+    return !(d & 1) || (path_walkable(g, nx, y) && path_walkable(g, x, ny));
+}
+
+void flow_field_compute(FlowField* f, const PathGrid* grid, PathCell target, PathHeapEntry** heap,
+                        int* heap_capacity) {
+    int size = f->size;
+    int radius = size / 2;
+    f->x0 = target.x - radius;
+    f->y0 = target.y - radius;
+    f->target = target;
+    f->valid = true;
+    for (int i = 0; i < size * size; ++i) {
+        f->cost[i] = INFINITY;
+        f->dir[i] = flow_none;
+    }
+    if (!path_walkable(grid, target.x, target.y)) return;
+
+    // Every improvement pushes, a cell can be pushed once per neighbour
+    if (*heap_capacity < 8 * size * size) {
+        *heap_capacity = 8 * size * size;
+        *heap = (PathHeapEntry*)realloc(*heap, *heap_capacity * sizeof(PathHeapEntry));
+    }
+    int n = 0;
+    int start = radius * size + radius;
+    f->cost[start] = 0;
+    path_heap_push(*heap, &n, {0, start});
+    while (n > 0) {
+        PathHeapEntry e = path_heap_pop(*heap, &n);
+        if (e.f > f->cost[e.id]) continue;
+        int x = e.id % size;
+        int y = e.id / size;
+        for (int d = 0; d < 8; ++d) {
+            int nx = x + flow_dx[d];
+            int ny = y + flow_dy[d];
+            if (nx < 0 || ny < 0 || nx >= size || ny >= size) continue;
+            if (!flow_can_move(grid, f->x0 + x, f->y0 + y, d)) continue;
+
+            float c = e.f + ((d & 1) ? path_diagonal_cost : 1);
+            int ni = ny * size + nx;
+            if (c < f->cost[ni]) {
+                f->cost[ni] = c;
+                path_heap_push(*heap, &n, {c, ni});
+            }
+        }
+    }
+
+    // Following the cheapest reachable neighbour goes down the wavefront to the target
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x) {
+            float best = f->cost[y * size + x];
+            if (best == INFINITY) continue;
+            for (int d = 0; d < 8; ++d) {
+                int nx = x + flow_dx[d];
+                int ny = y + flow_dy[d];
+                if (nx < 0 || ny < 0 || nx >= size || ny >= size) continue;
+                if (f->cost[ny * size + nx] < best && flow_can_move(grid, f->x0 + x, f->y0 + y, d)) {
+                    best = f->cost[ny * size + nx];
+                    f->dir[y * size + x] = d;
+                }
+            }
+        }
+}
+
+static void flow_field_worker_run(FlowFieldWorker* w) {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    while (true) {
+        w->wake.wait(lock, [w] { return w->stop || (w->busy && !w->done); });
+        if (w->stop) return;
+
+        FlowField* back = &w->fields[1 - w->front];
+        PathCell target = w->requested;
+        lock.unlock();
+        flow_field_compute(back, &w->grid, target, &w->heap, &w->heap_capacity);
+        lock.lock();
+        w->done = true;
+        w->idle.notify_all();
+    }
+}
+
+void flow_field_worker_start(FlowFieldWorker* w, PathGrid grid, int radius) {
+    w->grid = grid;
+    w->fields[0] = flow_field_create(radius);
+    w->fields[1] = flow_field_create(radius);
+    w->front = 0;
+    w->stop = false;
+    w->busy = false;
+    w->done = false;
+    w->stale = false;
+    w->running = true;
+    w->thread = std::thread(flow_field_worker_run, w);
+}
+
+void flow_field_worker_stop(FlowFieldWorker* w) {
+    if (!w->running) return;
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->stop = true;
+    }
+    w->wake.notify_all();
+    w->thread.join();
+    w->running = false;
+    flow_field_destroy(&w->fields[0]);
+    flow_field_destroy(&w->fields[1]);
+    free(w->heap);
+    w->heap = NULL;
+    w->heap_capacity = 0;
+}
+
+FlowFieldWorker::~FlowFieldWorker() {
+    flow_field_worker_stop(this);
+}
+
+const FlowField* flow_field_update(FlowFieldWorker* w, PathCell target) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    if (w->done) {
+        w->front = 1 - w->front;
+        w->busy = false;
+        w->done = false;
+    }
+
+    // The back field is free until the worker is given a target
+    FlowField* f = &w->fields[w->front];
+    bool moved = !f->valid || abs(target.x - f->target.x) > 1 || abs(target.y - f->target.y) > 1;
+    if (!w->busy && (moved || w->stale)) {
+        w->requested = target;
+        w->busy = true;
+        w->stale = false;
+        w->wake.notify_one();
+    }
+    return f;
+}
+
+void flow_field_worker_wait(FlowFieldWorker* w) {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    w->idle.wait(lock, [w] { return !w->busy || w->done; });
+}
+
+void flow_field_worker_invalidate(FlowFieldWorker* w) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->stale = true;
+}
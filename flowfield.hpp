@@ -0,0 +1,82 @@
+#ifndef FLOWFIELD_HPP
+#define FLOWFIELD_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "math.hpp"
+#include "pathfinding.hpp"
+
+// Directions to a target over a square window of the grid centred on it, for any number of agents
+// heading the same way. The integration field is the path cost to the target (Dijkstra wavefront,
+// same moves as pathfinding.hpp), and each cell points at its cheapest neighbour.
+const uint8_t flow_none = 8;  // the target, blocked, or no path within the window
+
+struct FlowField {
+    int x0;
+    int y0;
+    int size;  // of the window, 2 * radius + 1
+    PathCell target;
+    bool valid;
+    float* cost;  // size * size, INFINITY where unreachable
+    uint8_t* dir; // size * size, index into flow_directions or flow_none
+};
+
+extern const Vec2 flow_directions[9];
+
+FlowField flow_field_create(int radius);
+void flow_field_destroy(FlowField* f);
+
+// Fills the field for `target`. `heap` is scratch grown as needed, owned by the caller.
+void flow_field_compute(FlowField* f, const PathGrid* grid, PathCell target, PathHeapEntry** heap,
+                        int* heap_capacity);
+
+// Unit direction to move at p, zero outside the window or where there is no path
+inline Vec2 flow_field_sample(const FlowField* f, Vec2 p) {
+    int x = (int)floorf(p.x) - f->x0;
+    int y = (int)floorf(p.y) - f->y0;
+    if (!f->valid || x < 0 || y < 0 || x >= f->size || y >= f->size) return {};
+    return flow_directions[f->dir[y * f->size + x]];
+}
+
+// Recomputes fields on its own thread. Two fields: the front one is read by the main thread
+// while the back one is being filled, they swap in flow_field_update.
+struct FlowFieldWorker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool running = false;
+    bool stop = false;
+    bool busy = false;   // back field being filled
+    bool done = false;   // back field filled, not swapped in yet
+    bool stale = false;  // grid changed since the front field was computed
+
+    PathGrid grid;
+    FlowField fields[2];
+    int front = 0;
+    PathCell requested;
+
+    // Worker's own
+    PathHeapEntry* heap = NULL;
+    int heap_capacity = 0;
+
+    // Stops the thread at exit
+    ~FlowFieldWorker();
+};
+
+void flow_field_worker_start(FlowFieldWorker* w, PathGrid grid, int radius);
+void flow_field_worker_stop(FlowFieldWorker* w);
+
+// Swaps in a finished field, then asks for a new one if the target moved by more than a cell or
+// the grid changed. Returns the field to sample this frame. Main thread only.
+const FlowField* flow_field_update(FlowFieldWorker* w, PathCell target);
+
+// Waits for the worker to be idle. The grid must not change while it's busy.
+void flow_field_worker_wait(FlowFieldWorker* w);
+
+// After the grid changed: the next update recomputes even if the target didn't move
+void flow_field_worker_invalidate(FlowFieldWorker* w);
+
+#endif /* FLOWFIELD_HPP */
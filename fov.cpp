@@ -0,0 +1,155 @@
+#include "fov.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Octant transforms: a cell at column dx, row dy of the octant (dy <= dx <= 0, dy <= 0) is at
+// origin + (dx * xx + dy * xy, dx * yx + dy * yy)
+static const int octant_xx[8] = {1, 0, 0, -1, -1, 0, 0, 1};
+static const int octant_xy[8] = {0, 1, -1, 0, 0, -1, 1, 0};
+static const int octant_yx[8] = {0, 1, 1, 0, 0, -1, -1, 0};
+static const int octant_yy[8] = {1, 0, 0, 1, -1, 0, 0, -1};
+
+Fov fov_create(int w, int h, int radius, const uint8_t* opaque) {
+    Fov f = {
+        .w = w,
+        .h = h,
+        .radius = radius,
+        .opaque = opaque,
+        .movers = (uint8_t*)calloc(w * h, 1),
+        .visible = (uint8_t*)calloc(w * h, 1),
+        .explored = (uint8_t*)calloc(w * h, 1),
+    };
+    return f;
+}
+
+void fov_destroy(Fov* f) {
+    free(f->movers);
+    free(f->visible);
+    free(f->explored);
+    for (int o = 0; o < 8; ++o) free(f->lit[o]);
+    free(f->mover_cells);
+    free(f->was_blocked);
+}
+
+// Octants whose cells include (x, y) and are in range of the origin
+static uint8_t octants_of(const Fov* f, int x, int y) {
+    int rx = x - f->origin.x;
+    int ry = y - f->origin.y;
+    if (rx * rx + ry * ry > f->radius * f->radius) return 0;
+    uint8_t mask = 0;
+    for (int o = 0; o < 8; ++o) {
+        // The transforms are signed permutations, inverted by transposing
+        int dx = octant_xx[o] * rx + octant_yx[o] * ry;
+        int dy = octant_xy[o] * rx + octant_yy[o] * ry;
+        if (dy <= dx && dx <= 0) mask |= 1 << o;
+    }
+    return mask;
+}
+
+void fov_opacity_changed(Fov* f, int x, int y) {
+    if (f->has_origin) f->dirty |= octants_of(f, x, y);
+}
+
+void fov_invalidate(Fov* f) {
+    f->dirty = 0xff;
+}
+
+void fov_set_movers(Fov* f, const PathCell* cells, int n) {
+    int n_touched = f->n_movers + n;
+    if (n_touched > f->mover_capacity) {
+        f->mover_capacity = 2 * n_touched;
+        f->mover_cells = (PathCell*)realloc(f->mover_cells, f->mover_capacity * sizeof(PathCell));
+        f->was_blocked = (bool*)realloc(f->was_blocked, f->mover_capacity * sizeof(bool));
+    }
+    // Old cells then new ones, the new list becomes the old one for next time
+    memcpy(f->mover_cells + f->n_movers, cells, n * sizeof(PathCell));
+    PathCell* touched = f->mover_cells;
+    for (int i = 0; i < n_touched; ++i) {
+        PathCell c = touched[i];
+        f->was_blocked[i] = c.x >= 0 && c.y >= 0 && c.x < f->w && c.y < f->h && fov_blocks(f, c.x, c.y);
+    }
+    for (int i = 0; i < n_touched; ++i) {
+        PathCell c = touched[i];
+        if (c.x < 0 || c.y < 0 || c.x >= f->w || c.y >= f->h) continue;
+        if (i < f->n_movers) {
+            f->movers[c.y * f->w + c.x]--;
+        } else {
+            f->movers[c.y * f->w + c.x]++;
+        }
+    }
+    for (int i = 0; i < n_touched; ++i) {
+        PathCell c = touched[i];
+        if (c.x < 0 || c.y < 0 || c.x >= f->w || c.y >= f->h) continue;
+        if (fov_blocks(f, c.x, c.y) != f->was_blocked[i]) fov_opacity_changed(f, c.x, c.y);
+    }
+    memmove(f->mover_cells, f->mover_cells + f->n_movers, n * sizeof(PathCell));
+    f->n_movers = n;
+}
+
+static void octant_light(Fov* f, int o, int x, int y) {
+    int i = y * f->w + x;
+    f->visible[i]++;
+    f->explored[i] = 1;
+    if (f->n_lit[o] == f->lit_capacity[o]) {
+        f->lit_capacity[o] = f->lit_capacity[o] ? 2 * f->lit_capacity[o] : 256;
+        f->lit[o] = (int*)realloc(f->lit[o], f->lit_capacity[o] * sizeof(int));
+    }
+    f->lit[o][f->n_lit[o]++] = i;
+}
+
+// Scans rows from `row` outwards between slopes start > end, recursing past each run of blockers
+static void cast_light(Fov* f, int o, int row, float start, float end) {
+    if (start < end) return;
+    int r2 = f->radius * f->radius;
+    float new_start = 0;
+    for (int j = row; j <= f->radius; ++j) {
+        int dy = -j;
+        bool blocked = false;
+        for (int dx = -j; dx <= 0; ++dx) {
+            float l_slope = (dx - 0.5f) / (dy + 0.5f);
+            float r_slope = (dx + 0.5f) / (dy - 0.5f);
+            if (start < r_slope) continue;
+            if (end > l_slope) break;
+
+            int x = f->origin.x + dx * octant_xx[o] + dy * octant_xy[o];
+            int y = f->origin.y + dx * octant_yx[o] + dy * octant_yy[o];
+            bool inside = x >= 0 && y >= 0 && x < f->w && y < f->h;
+            if (inside && dx * dx + dy * dy <= r2) octant_light(f, o, x, y);
+
+            // Outside the grid blocks like a wall
+            bool opaque = !inside || fov_blocks(f, x, y);
+            if (blocked) {
+                if (opaque) {
+                    new_start = r_slope;
+                } else {
+                    blocked = false;
+                    start = new_start;
+                }
+            } else if (opaque && j < f->radius) {
+                blocked = true;
+                cast_light(f, o, j + 1, start, l_slope);
+                new_start = r_slope;
+            }
+        }
+        if (blocked) break;
+    }
+}
+
+void fov_update(Fov* f, PathCell origin) {
+    if (!f->has_origin || origin.x != f->origin.x || origin.y != f->origin.y) f->dirty = 0xff;
+    f->origin = origin;
+    f->has_origin = true;
+
+    for (int o = 0; o < 8; ++o) {
+        if (!(f->dirty & (1 << o))) continue;
+        for (int k = 0; k < f->n_lit[o]; ++k) f->visible[f->lit[o][k]]--;
+        f->n_lit[o] = 0;
+        if (origin.x < 0 || origin.y < 0 || origin.x >= f->w || origin.y >= f->h) continue;
+
+        // Row 0 is the origin, seen by every octant
+        octant_light(f, o, origin.x, origin.y);
+        cast_light(f, o, 1, 1, 0);
+    }
+    f->dirty = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef FOV_HPP
+#define FOV_HPP
+
+#include <stdint.h>
+
+#include "pathfinding.hpp"
+
+// Grid field of view by recursive shadowcasting, one octant at a time. A cell blocks sight when
+// the caller's `opaque` is nonzero or a mover stands on it. Each octant remembers the cells it
+// lit, so an opacity change only recasts the octants that can see it, and the cost of an update
+// depends on the radius, not the grid.
+struct Fov {
+    int w;
+    int h;
+    int radius;
+    const uint8_t* opaque;  // w * h, owned by the caller, see fov_opacity_changed
+    uint8_t* movers;        // w * h, movers on each cell
+    uint8_t* visible;       // w * h, octants seeing each cell, cells on an octant edge are in two
+    uint8_t* explored;      // w * h, 1 once seen, never cleared
+    PathCell origin;
+    bool has_origin;
+
+    uint8_t dirty;          // one bit per octant to recast
+    int* lit[8];            // cells each octant made visible
+    int n_lit[8];
+    int lit_capacity[8];
+
+    // Movers as last set, and scratch to see which cells flipped
+    PathCell* mover_cells;
+    int n_movers;
+    int mover_capacity;
+    bool* was_blocked;
+};
+
+Fov fov_create(int w, int h, int radius, const uint8_t* opaque);
+void fov_destroy(Fov* f);
+
+inline bool fov_blocks(const Fov* f, int x, int y) {
+    int i = y * f->w + x;
+    return f->opaque[i] || f->movers[i];
+}
+
+inline bool fov_visible(const Fov* f, int x, int y) {
+    return x >= 0 && y >= 0 && x < f->w && y < f->h && f->visible[y * f->w + x];
+}
+
+// After the caller changed opaque at (x, y)
+void fov_opacity_changed(Fov* f, int x, int y);
+
+// After the caller changed opaque anywhere
+void fov_invalidate(Fov* f);
+
+// Replaces the cells moving occluders stand on. Only cells that start or stop blocking recast.
+void fov_set_movers(Fov* f, const PathCell* cells, int n);
+
+// Recasts what changed since the last update. Moving the origin recasts all octants.
+void fov_update(Fov* f, PathCell origin);
+
+#endif /* FOV_HPP */
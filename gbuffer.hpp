@@ -0,0 +1,72 @@
+#ifndef GBUFFER_HPP
+#define GBUFFER_HPP
+
+#include <stdint.h>
+
+#include "math.hpp"
+#include "simd.hpp"
+
+// Compact per-texel surface attributes: normals are octahedral-encoded as two 16-bit values, albedo
+// is 8 bits per channel. Both fit a uint32 so a texel costs 8 bytes instead of two float Vec3.
+
+inline float sign_not_zero(float a) {
+    return a >= 0 ? 1 : -1;
+}
+
+inline uint32_t normal_encode(Vec3 n) {
+    // Project onto the octahedron |x| + |y| + |z| = 1, fold the lower half over the upper one
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float u = n.x / l1;
+    float v = n.y / l1;
+    if (n.z < 0) {
+        float fu = (1 - fabsf(v)) * sign_not_zero(u);
+        float fv = (1 - fabsf(u)) * sign_not_zero(v);
+        u = fu;
+        v = fv;
+    }
+    uint32_t qu = (uint32_t)lroundf((u * 0.5f + 0.5f) * 65535);
+    uint32_t qv = (uint32_t)lroundf((v * 0.5f + 0.5f) * 65535);
+    return qu | (qv << 16);
+}
+
+inline Vec3 normal_decode(uint32_t p) {
+    float u = (p & 0xffff) * (2.f / 65535) - 1;
+    float v = (p >> 16) * (2.f / 65535) - 1;
+    float z = 1 - fabsf(u) - fabsf(v);
+    float t = fmaxf(-z, 0);
+    Vec3 n = {u >= 0 ? u - t : u + t, v >= 0 ? v - t : v + t, z};
+    return vec3_normalize(n);
+}
+
+inline uint32_t albedo_encode(Vec3 c) {
+    uint32_t r = (uint32_t)lroundf(clampf(c.x, 0, 1) * 255);
+    uint32_t g = (uint32_t)lroundf(clampf(c.y, 0, 1) * 255);
+    uint32_t b = (uint32_t)lroundf(clampf(c.z, 0, 1) * 255);
+    return r | (g << 8) | (b << 16);
+}
+
+inline Vec3 albedo_decode(uint32_t p) {
+    return {(p & 0xff) / 255.f, ((p >> 8) & 0xff) / 255.f, ((p >> 16) & 0xff) / 255.f};
+}
+
+// Eight texels at once, same math as the scalar versions
+inline void normal_decode8(u32x8 p, f32x8* x, f32x8* y, f32x8* z) {
+    f32x8 u = f32x8_from_i32x8((i32x8)(p & 0xffff)) * (2.f / 65535) - 1;
+    f32x8 v = f32x8_from_i32x8((i32x8)(p >> 16)) * (2.f / 65535) - 1;
+    f32x8 w = 1 - f32x8_abs(u) - f32x8_abs(v);
+    f32x8 t = w < 0 ? -w : f32x8_set1(0);
+    u = u >= 0 ? u - t : u + t;
+    v = v >= 0 ? v - t : v + t;
+    f32x8 inv_norm = 1 / f32x8_sqrt(u * u + v * v + w * w);
+    *x = u * inv_norm;
+    *y = v * inv_norm;
+    *z = w * inv_norm;
+}
+
+inline void albedo_decode8(u32x8 p, f32x8* r, f32x8* g, f32x8* b) {
+    *r = f32x8_from_i32x8((i32x8)(p & 0xff)) * (1.f / 255);
+    *g = f32x8_from_i32x8((i32x8)((p >> 8) & 0xff)) * (1.f / 255);
+    *b = f32x8_from_i32x8((i32x8)((p >> 16) & 0xff)) * (1.f / 255);
+}
+
+#endif /* GBUFFER_HPP */
@@ -116,6 +116,22 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
 int main(int argc, char** argv) {
     std::srand(std::time(0));
 
+    // Optional world size in cells, square. The player, lights and first ground samples are placed
+    // within the first 200 cells.
+    const long min_world_size = 200;
+    // The G-buffer, light cache, mips, scenery shadows, sight and path grids are dense, about 30
+    // bytes a cell, so this is around 2 GB
+    const long max_world_size = 8192;
+    long world_size = 1000;
+    if (argc > 1) {
+        char* end;
+        world_size = strtol(argv[1], &end, 10);
+        if (*end || end == argv[1] || world_size < min_world_size || world_size > max_world_size) {
+            printf("usage: %s [world size, %ld to %ld cells]\n", argv[0], min_world_size, max_world_size);
+            return 1;
+        }
+    }
+
     if (!glfwInit()) {
         printf("Cannot initialize GLFW\n");
         abort();
@@ -138,7 +154,7 @@ int main(int argc, char** argv) {
     glfwSetScrollCallback(window, scroll_callback);
 
     init_texture();
-    world_init();
+    world_init(world_size, world_size);
 
     while (running) {
         // if (glfwJoystickIsGamepad(GLFW_JOYSTICK_1)) {
@@ -147,7 +163,7 @@ int main(int argc, char** argv) {
         // }
 
         float dt = timer_dt.tick();
-        printf("fps: %.2f\n", 1 / dt);
+        printf("fps: %.2f, render scale: %.2f\n", 1 / dt, world_render_scale());
         world_update(dt);
 
         // terrain_draw();
@@ -0,0 +1,385 @@
+#include "pathfinding.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+const int cluster_cells = hpa_cluster_size * hpa_cluster_size;
+
+enum Side {
+    SIDE_LEFT,
+    SIDE_RIGHT,
+    SIDE_TOP,
+    SIDE_BOTTOM,
+};
+
+static const int opposite_side[4] = {SIDE_RIGHT, SIDE_LEFT, SIDE_BOTTOM, SIDE_TOP};
+static const int side_dx[4] = {-1, 1, 0, 0};
+static const int side_dy[4] = {0, 0, -1, 1};
+
+void path_heap_push(PathHeapEntry* heap, int* n, PathHeapEntry e) {
+    int i = (*n)++;
+    while (i > 0) {
+        int up = (i - 1) / 2;
+        if (heap[up].f <= e.f) break;
+        heap[i] = heap[up];
+        i = up;
+    }
+    heap[i] = e;
+}
+
+PathHeapEntry path_heap_pop(PathHeapEntry* heap, int* n) {
+    PathHeapEntry top = heap[0];
+    PathHeapEntry last = heap[--(*n)];
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= *n) break;
+        if (child + 1 < *n && heap[child + 1].f < heap[child].f) child++;
+        if (last.f <= heap[child].f) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static float octile(PathCell a, PathCell b) {
+    int dx = abs(a.x - b.x);
+    int dy = abs(a.y - b.y);
+    return dx > dy ? dx + (path_diagonal_cost - 1) * dy : dy + (path_diagonal_cost - 1) * dx;
+}
+
+// Cells of a cluster, clipped at the grid edge
+struct ClusterRect {
+    int x0;
+    int y0;
+    int w;
+    int h;
+};
+
+static ClusterRect cluster_rect(Hpa* hpa, int c) {
+    int x0 = (c % hpa->clusters_x) * hpa_cluster_size;
+    int y0 = (c / hpa->clusters_x) * hpa_cluster_size;
+    int x1 = x0 + hpa_cluster_size < hpa->grid.w ? x0 + hpa_cluster_size : hpa->grid.w;
+    int y1 = y0 + hpa_cluster_size < hpa->grid.h ? y0 + hpa_cluster_size : hpa->grid.h;
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+// Dijkstra from `from` without leaving the rectangle. `dist` and `parent` are indexed by cell in
+// the rectangle, INFINITY and -1 where it isn't reached. With `to` set it's A* and stops once `to`
+// is settled, the rest is then incomplete.
+static void local_search(const PathGrid* g, ClusterRect r, PathCell from, float* dist, int* parent,
+                         const PathCell* to = NULL) {
+    for (int i = 0; i < r.w * r.h; ++i) {
+        dist[i] = INFINITY;
+        parent[i] = -1;
+    }
+    // A cell is pushed at most once per neighbour that improves it
+    PathHeapEntry heap[cluster_cells * 8];
+    int n = 0;
+    int start = (from.y - r.y0) * r.w + (from.x - r.x0);
+    dist[start] = 0;
+    path_heap_push(heap, &n, {0, start});
+    int target = to ? (to->y - r.y0) * r.w + (to->x - r.x0) : -1;
+    auto h = [&](int x, int y) { return to ? octile({r.x0 + x, r.y0 + y}, *to) : 0.f; };
+
+    while (n > 0) {
+        PathHeapEntry e = path_heap_pop(heap, &n);
+        if (e.id == target) break;
+        int x = e.id % r.w;
+        int y = e.id / r.w;
+        float g_here = dist[e.id];
+        if (e.f > g_here + h(x, y)) continue;  // stale
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx) {
+                if (dx == 0 && dy == 0) continue;
+                int nx = x + dx;
+                int ny = y + dy;
+                if (nx < 0 || ny < 0 || nx >= r.w || ny >= r.h) continue;
+                if (!path_walkable(g, r.x0 + nx, r.y0 + ny)) continue;
+                if (dx != 0 && dy != 0 &&
+                    (!path_walkable(g, r.x0 + nx, r.y0 + y) || !path_walkable(g, r.x0 + x, r.y0 + ny)))
+                    continue;
+
+                float d = g_here + (dx != 0 && dy != 0 ? path_diagonal_cost : 1);
+                int ni = ny * r.w + nx;
+                if (d < dist[ni]) {
+                    dist[ni] = d;
+                    parent[ni] = e.id;
+                    path_heap_push(heap, &n, {d + h(nx, ny), ni});
+                }
+            }
+    }
+}
+
+// Entrances on one side: runs of cells open on both sides of the border get one node in the
+// middle, or one at each end if they are long.
+static void add_side_nodes(Hpa* hpa, HpaCluster* c, ClusterRect r, int side) {
+    const int long_run = 6;
+    bool vertical = side == SIDE_LEFT || side == SIDE_RIGHT;
+    int length = vertical ? r.h : r.w;
+    int bx = side == SIDE_RIGHT ? r.x0 + r.w - 1 : r.x0;
+    int by = side == SIDE_BOTTOM ? r.y0 + r.h - 1 : r.y0;
+    int ox = bx + side_dx[side];
+    int oy = by + side_dy[side];
+    if (ox < 0 || oy < 0 || ox >= hpa->grid.w || oy >= hpa->grid.h) return;
+
+    int run_start = -1;
+    for (int i = 0; i <= length; ++i) {
+        bool open = false;
+        if (i < length) {
+            int sx = vertical ? 0 : i;
+            int sy = vertical ? i : 0;
+            open = path_walkable(&hpa->grid, bx + sx, by + sy) && path_walkable(&hpa->grid, ox + sx, oy + sy);
+        }
+        if (open && run_start < 0) run_start = i;
+        if (open || run_start < 0) continue;
+
+        int run_end = i - 1;
+        int at[2] = {(run_start + run_end) / 2, run_end};
+        int n_at = 1;
+        if (run_end - run_start + 1 >= long_run) {
+            at[0] = run_start;
+            n_at = 2;
+        }
+        for (int k = 0; k < n_at; ++k) {
+            c->node[c->n_nodes++] = {vertical ? bx : bx + at[k], vertical ? by + at[k] : by};
+        }
+        run_start = -1;
+    }
+}
+
+static void build_cluster(Hpa* hpa, int ci) {
+    HpaCluster* c = &hpa->clusters[ci];
+    ClusterRect r = cluster_rect(hpa, ci);
+
+    // At most one node per cell of the border, a run needs a closed cell between it and the next
+    free(c->node);
+    free(c->cost);
+    c->node = (PathCell*)malloc(4 * hpa_cluster_size * sizeof(PathCell));
+    c->n_nodes = 0;
+    for (int side = 0; side < 4; ++side) {
+        c->side_start[side] = c->n_nodes;
+        add_side_nodes(hpa, c, r, side);
+    }
+    c->side_start[4] = c->n_nodes;
+
+    int n = c->n_nodes;
+    c->cost = (float*)malloc(n * n * sizeof(float));
+    float dist[cluster_cells];
+    int parent[cluster_cells];
+    for (int i = 0; i < n; ++i) {
+        // Costs are symmetric, the last node's were all found by the others
+        c->cost[i * n + i] = 0;
+        if (i == n - 1) break;
+        local_search(&hpa->grid, r, c->node[i], dist, parent);
+        for (int j = i + 1; j < n; ++j) {
+            float d = dist[(c->node[j].y - r.y0) * r.w + (c->node[j].x - r.x0)];
+            c->cost[i * n + j] = d;
+            c->cost[j * n + i] = d;
+        }
+    }
+}
+
+// Node ids and search buffers after clusters changed
+static void update_ids(Hpa* hpa) {
+    int n_clusters = hpa->clusters_x * hpa->clusters_y;
+    hpa->n_nodes = 0;
+    for (int c = 0; c < n_clusters; ++c) {
+        hpa->node_base[c] = hpa->n_nodes;
+        hpa->n_nodes += hpa->clusters[c].n_nodes;
+    }
+
+    int capacity = hpa->n_nodes + 2;
+    if (capacity > hpa->search_capacity) {
+        hpa->search_capacity = capacity;
+        hpa->g = (float*)realloc(hpa->g, capacity * sizeof(float));
+        hpa->parent = (int*)realloc(hpa->parent, capacity * sizeof(int));
+        hpa->visited = (uint32_t*)realloc(hpa->visited, capacity * sizeof(uint32_t));
+        hpa->node_cluster = (int*)realloc(hpa->node_cluster, capacity * sizeof(int));
+        memset(hpa->visited, 0, capacity * sizeof(uint32_t));
+        hpa->stamp = 0;
+    }
+    for (int c = 0; c < n_clusters; ++c)
+        for (int i = 0; i < hpa->clusters[c].n_nodes; ++i) hpa->node_cluster[hpa->node_base[c] + i] = c;
+}
+
+void hpa_build(Hpa* hpa, PathGrid grid) {
+    hpa_destroy(hpa);
+    hpa->grid = grid;
+    hpa->clusters_x = (grid.w + hpa_cluster_size - 1) / hpa_cluster_size;
+    hpa->clusters_y = (grid.h + hpa_cluster_size - 1) / hpa_cluster_size;
+    int n_clusters = hpa->clusters_x * hpa->clusters_y;
+    hpa->clusters = (HpaCluster*)calloc(n_clusters, sizeof(HpaCluster));
+    hpa->node_base = (int*)malloc(n_clusters * sizeof(int));
+    for (int c = 0; c < n_clusters; ++c) build_cluster(hpa, c);
+    update_ids(hpa);
+}
+
+void hpa_destroy(Hpa* hpa) {
+    for (int c = 0; c < hpa->clusters_x * hpa->clusters_y; ++c) {
+        free(hpa->clusters[c].node);
+        free(hpa->clusters[c].cost);
+    }
+    free(hpa->clusters);
+    free(hpa->node_base);
+    free(hpa->node_cluster);
+    free(hpa->g);
+    free(hpa->parent);
+    free(hpa->visited);
+    free(hpa->heap);
+    *hpa = {};
+}
+
+void hpa_repair(Hpa* hpa, int x0, int y0, int x1, int y1) {
+    if (x1 <= x0 || y1 <= y0) return;
+    // Entrances on a changed border belong to the clusters on both sides
+    int cx0 = x0 / hpa_cluster_size - 1;
+    int cy0 = y0 / hpa_cluster_size - 1;
+    int cx1 = (x1 - 1) / hpa_cluster_size + 1;
+    int cy1 = (y1 - 1) / hpa_cluster_size + 1;
+    for (int cy = cy0 < 0 ? 0 : cy0; cy <= cy1 && cy < hpa->clusters_y; ++cy)
+        for (int cx = cx0 < 0 ? 0 : cx0; cx <= cx1 && cx < hpa->clusters_x; ++cx) {
+            build_cluster(hpa, cy * hpa->clusters_x + cx);
+        }
+    update_ids(hpa);
+}
+
+// The entrance on the other side of the border, at the same place in the neighbour's side list
+static int partner(Hpa* hpa, int c, int i) {
+    HpaCluster* cluster = &hpa->clusters[c];
+    int side = 0;
+    while (i >= cluster->side_start[side + 1]) side++;
+    int d = c + side_dy[side] * hpa->clusters_x + side_dx[side];
+    return hpa->node_base[d] + hpa->clusters[d].side_start[opposite_side[side]] + (i - cluster->side_start[side]);
+}
+
+static void search_relax(Hpa* hpa, int* n_heap, int id, int from, float g, float h) {
+    if (hpa->visited[id] == hpa->stamp && hpa->g[id] <= g) return;
+    hpa->visited[id] = hpa->stamp;
+    hpa->g[id] = g;
+    hpa->parent[id] = from;
+    if (*n_heap == hpa->heap_capacity) {
+        hpa->heap_capacity = hpa->heap_capacity ? 2 * hpa->heap_capacity : 1024;
+        hpa->heap = (PathHeapEntry*)realloc(hpa->heap, hpa->heap_capacity * sizeof(PathHeapEntry));
+    }
+    path_heap_push(hpa->heap, n_heap, {g + h, id});
+}
+
+// Appends the cells after `from` up to `to`, both in cluster `c`
+static int refine_local(Hpa* hpa, int c, PathCell from, PathCell to, PathCell* path, int n, int capacity) {
+    ClusterRect r = cluster_rect(hpa, c);
+    float dist[cluster_cells];
+    int parent[cluster_cells];
+    local_search(&hpa->grid, r, from, dist, parent, &to);
+
+    int steps[cluster_cells];
+    int n_steps = 0;
+    for (int i = (to.y - r.y0) * r.w + (to.x - r.x0); parent[i] >= 0; i = parent[i]) steps[n_steps++] = i;
+    for (int k = n_steps - 1; k >= 0; --k, ++n) {
+        if (n < capacity) path[n] = {r.x0 + steps[k] % r.w, r.y0 + steps[k] / r.w};
+    }
+    return n;
+}
+
+int hpa_find_path(Hpa* hpa, PathCell start, PathCell goal, PathCell* path, int capacity) {
+    const PathGrid* grid = &hpa->grid;
+    if (!path_walkable(grid, start.x, start.y) || !path_walkable(grid, goal.x, goal.y)) return -1;
+
+    int start_id = hpa->n_nodes;
+    int goal_id = hpa->n_nodes + 1;
+    int start_cluster = (start.y / hpa_cluster_size) * hpa->clusters_x + start.x / hpa_cluster_size;
+    int goal_cluster = (goal.y / hpa_cluster_size) * hpa->clusters_x + goal.x / hpa_cluster_size;
+    HpaCluster* sc = &hpa->clusters[start_cluster];
+
+    if (++hpa->stamp == 0) {
+        memset(hpa->visited, 0, hpa->search_capacity * sizeof(uint32_t));
+        hpa->stamp = 1;
+    }
+    int n_heap = 0;
+
+    // Start and goal join the abstract graph through their own clusters
+    ClusterRect sr = cluster_rect(hpa, start_cluster);
+    ClusterRect gr = cluster_rect(hpa, goal_cluster);
+    float start_dist[cluster_cells];
+    float goal_dist[cluster_cells];
+    int parent[cluster_cells];
+    local_search(grid, sr, start, start_dist, parent);
+    local_search(grid, gr, goal, goal_dist, parent);
+
+    hpa->visited[start_id] = hpa->stamp;
+    hpa->g[start_id] = 0;
+    hpa->parent[start_id] = -1;
+    if (start_cluster == goal_cluster) {
+        float d = start_dist[(goal.y - sr.y0) * sr.w + (goal.x - sr.x0)];
+        if (d < INFINITY) search_relax(hpa, &n_heap, goal_id, start_id, d, 0);
+    }
+    for (int i = 0; i < sc->n_nodes; ++i) {
+        float d = start_dist[(sc->node[i].y - sr.y0) * sr.w + (sc->node[i].x - sr.x0)];
+        if (d < INFINITY) search_relax(hpa, &n_heap, hpa->node_base[start_cluster] + i, start_id, d, octile(sc->node[i], goal));
+    }
+
+    bool found = false;
+    while (n_heap > 0) {
+        PathHeapEntry e = path_heap_pop(hpa->heap, &n_heap);
+        if (e.id == goal_id) {
+            found = true;
+            break;
+        }
+        int c = hpa->node_cluster[e.id];
+        int i = e.id - hpa->node_base[c];
+        HpaCluster* cluster = &hpa->clusters[c];
+        float g = hpa->g[e.id];
+        if (e.f > g + octile(cluster->node[i], goal)) continue;  // stale
+
+        if (c == goal_cluster) {
+            float d = goal_dist[(cluster->node[i].y - gr.y0) * gr.w + (cluster->node[i].x - gr.x0)];
+            if (d < INFINITY) search_relax(hpa, &n_heap, goal_id, e.id, g + d, 0);
+        }
+        int n = cluster->n_nodes;
+        for (int j = 0; j < n; ++j) {
+            float d = cluster->cost[i * n + j];
+            if (j == i || d == INFINITY) continue;
+            search_relax(hpa, &n_heap, hpa->node_base[c] + j, e.id, g + d, octile(cluster->node[j], goal));
+        }
+        int p = partner(hpa, c, i);
+        int pc = hpa->node_cluster[p];
+        search_relax(hpa, &n_heap, p, e.id, g + 1, octile(hpa->clusters[pc].node[p - hpa->node_base[pc]], goal));
+    }
+    if (!found) return -1;
+
+    // Reverse the parent links so the abstract path can be walked from the start
+    int next = -1;
+    for (int id = goal_id; id >= 0;) {
+        int up = hpa->parent[id];
+        hpa->parent[id] = next;
+        next = id;
+        id = up;
+    }
+
+    auto cell_of = [&](int id) {
+        if (id == start_id) return start;
+        if (id == goal_id) return goal;
+        int c = hpa->node_cluster[id];
+        return hpa->clusters[c].node[id - hpa->node_base[c]];
+    };
+
+    // Refine each step: across a border it's one move, otherwise a search in the shared cluster
+    int n = 0;
+    if (capacity > 0) path[0] = start;
+    n++;
+    for (int id = start_id; hpa->parent[id] >= 0; id = hpa->parent[id]) {
+        PathCell from = cell_of(id);
+        PathCell to = cell_of(hpa->parent[id]);
+        int from_cluster = (from.y / hpa_cluster_size) * hpa->clusters_x + from.x / hpa_cluster_size;
+        int to_cluster = (to.y / hpa_cluster_size) * hpa->clusters_x + to.x / hpa_cluster_size;
+        if (from_cluster == to_cluster) {
+            n = refine_local(hpa, from_cluster, from, to, path, n, capacity);
+        } else {
+            if (n < capacity) path[n] = to;
+            n++;
+        }
+    }
+    return n;
+}
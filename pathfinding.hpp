@@ -0,0 +1,81 @@
+#ifndef PATHFINDING_HPP
+#define PATHFINDING_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Grid paths are searched on, owned by the caller. A cell is blocked when bit `cells[i]` of
+// `blocked` is set, so a material map can be used as is. Moves are 8-connected, diagonals cost
+// sqrt(2) and can't cut the corner of a blocked cell.
+struct PathGrid {
+    int w;
+    int h;
+    const uint8_t* cells;
+    uint32_t blocked;
+};
+
+const float path_diagonal_cost = 1.41421356f;
+
+inline bool path_walkable(const PathGrid* g, int x, int y) {
+    return x >= 0 && y >= 0 && x < g->w && y < g->h && !((g->blocked >> g->cells[y * g->w + x]) & 1);
+}
+
+struct PathCell {
+    int x;
+    int y;
+};
+
+// Hierarchical pathfinding (HPA*). The grid is cut into square clusters. Every run of open cells
+// along a cluster border gets entrance nodes, one in the middle or two at the ends of long runs,
+// on both sides. Each cluster caches the path cost between its own entrances. Queries search this
+// small abstract graph, then refine each step with a search inside one cluster.
+const int hpa_cluster_size = 16;
+
+struct HpaCluster {
+    int n_nodes = 0;
+    PathCell* node = NULL;
+    float* cost = NULL;   // n_nodes * n_nodes, INFINITY when not connected inside the cluster
+    int side_start[5];    // nodes on the left, right, top and bottom border, in that order
+};
+
+struct PathHeapEntry {
+    float f;
+    int id;
+};
+
+// Binary min-heap on f over a caller-owned array
+void path_heap_push(PathHeapEntry* heap, int* n, PathHeapEntry e);
+PathHeapEntry path_heap_pop(PathHeapEntry* heap, int* n);
+
+struct Hpa {
+    PathGrid grid;
+    int clusters_x = 0;
+    int clusters_y = 0;
+    HpaCluster* clusters = NULL;
+    int* node_base = NULL;     // global id of each cluster's first node
+    int n_nodes = 0;
+    int* node_cluster = NULL;  // per global id
+
+    // Abstract search state, stamped so it doesn't need clearing between queries. Two extra ids
+    // stand for the start and goal of the query.
+    int search_capacity = 0;
+    float* g = NULL;
+    int* parent = NULL;
+    uint32_t* visited = NULL;
+    uint32_t stamp = 0;
+    int heap_capacity = 0;
+    PathHeapEntry* heap = NULL;
+};
+
+void hpa_build(Hpa* hpa, PathGrid grid);
+void hpa_destroy(Hpa* hpa);
+
+// Rebuilds what cells in [x0, x1) x [y0, y1) can affect after they changed: their clusters and
+// the neighbours sharing a border with them.
+void hpa_repair(Hpa* hpa, int x0, int y0, int x1, int y1);
+
+// Writes up to `capacity` cells of a path from start to goal, both included, and returns the
+// length of the whole path, or -1 if there is none.
+int hpa_find_path(Hpa* hpa, PathCell start, PathCell goal, PathCell* path, int capacity);
+
+#endif /* PATHFINDING_HPP */
@@ -2,21 +2,43 @@
 
 #include "math.hpp"
 #include "debug.h"
+#include "simd.hpp"
 
-Vec2 random_unit_vector() {
-    float angle = rand() % 360 * 3.1415f / 180.f;
-    return {std::cos(angle), std::sin(angle)};
+// Gradients come from an integer hash of the lattice coordinates instead of a stored table, so
+// there is no global state: any region can be evaluated on any thread, in any order, and
+// neighbouring chunks agree on their shared border. The same code is instantiated for scalars
+// and for eight lanes so both paths see the same lattice.
+template <typename U>
+U hash_finalize(U h) {
+    // lowbias32 finalizer (Chris Wellons)
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
 }
 
-Vec2* create_random_gradient_grid(int w, int h) {
-    Vec2* grid = (Vec2*)malloc(w * h * sizeof(Vec2));
+template <typename U>
+U lattice_hash(U seed, U x, U y) {
+    return hash_finalize(x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu);
+}
 
-    for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x) {
-            grid[y * w + x] = random_unit_vector();
-        }
+template <typename U>
+U lattice_hash(U seed, U x, U y, U z) {
+    return hash_finalize(x * 0x8da6b343u ^ y * 0xd8163841u ^ z * 0x9e3779b1u ^ seed * 0xcb1ab31fu);
+}
 
-    return grid;
+uint32_t noise_hash(uint32_t seed, int x, int y) {
+    return lattice_hash<uint32_t>(seed, x, y);
+}
+
+// Dot product with one of the four diagonal gradients selected by the low bits of the hash
+template <typename U, typename F>
+F gradient_dot(U hash, F x, F y) {
+    F gx = (hash & 1) ? -x : x;
+    F gy = (hash & 2) ? -y : y;
+    return gx + gy;
 }
 
 float smoothstep(float x) {
@@ -27,32 +49,347 @@ float lerp(float a, float b, float f) {
     return (1 - f) * a + f * b;
 }
 
-float perlin_noise(Vec2* gradients, int w, float x, float y) {
-    float x0 = floor(x);
-    float x1 = x0 + 1;
-    float y0 = floor(y);
-    float y1 = y0 + 1;
-    float fx = smoothstep(x - x0);
-    float fy = smoothstep(y - y0);
-    float dot00 = vec2_dot({x - x0, y - y0}, gradients[(int)y0 * w + (int)x0]);
-    float dot10 = vec2_dot({x - x1, y - y0}, gradients[(int)y0 * w + (int)x1]);
-    float dot01 = vec2_dot({x - x0, y - y1}, gradients[(int)y1 * w + (int)x0]);
-    float dot11 = vec2_dot({x - x1, y - y1}, gradients[(int)y1 * w + (int)x1]);
+float perlin_noise(uint32_t seed, float x, float y) {
+    int ix0 = floor(x);
+    int iy0 = floor(y);
+    uint32_t x0 = ix0;
+    uint32_t y0 = iy0;
+    float dx0 = x - ix0;
+    float dy0 = y - iy0;
+    float dx1 = dx0 - 1;
+    float dy1 = dy0 - 1;
+    float dot00 = gradient_dot(lattice_hash(seed, x0, y0), dx0, dy0);
+    float dot10 = gradient_dot(lattice_hash(seed, x0 + 1, y0), dx1, dy0);
+    float dot01 = gradient_dot(lattice_hash(seed, x0, y0 + 1), dx0, dy1);
+    float dot11 = gradient_dot(lattice_hash(seed, x0 + 1, y0 + 1), dx1, dy1);
+    float fx = smoothstep(dx0);
+    float fy = smoothstep(dy0);
     float xa = lerp(dot00, dot10, fx);
     float xb = lerp(dot01, dot11, fx);
     return lerp(xa, xb, fy);
 }
 
-float* create_perlin_grid(int w, int h, float scale) {
+float* create_perlin_grid(int w, int h, float scale, uint32_t seed) {
     float* grid = (float*)malloc(w * h * sizeof(float));
-    int gradients_w = ceil(w * scale);
-    int gradients_h = ceil(h * scale);
-    Vec2* gradients = create_random_gradient_grid(gradients_w, gradients_h);
     for (int y = 0; y < h; ++y)
         for (int x = 0; x < w; ++x) {
-            grid[y * w + x] = perlin_noise(gradients, gradients_w, x * scale, y * scale);
+            grid[y * w + x] = perlin_noise(seed, x * scale, y * scale);
         }
-    free(gradients);
     return grid;
 }
 
+// Eight Perlin samples along a row: all lanes share the same `y`
+static f32x8 perlin_noise8(uint32_t seed, f32x8 x, float y) {
+    i32x8 ix0 = i32x8_floor(x);
+    int iy0 = floor(y);
+    f32x8 dx0 = x - f32x8_from_i32x8(ix0);
+    f32x8 dx1 = dx0 - 1;
+    f32x8 dy0 = f32x8_set1(y - iy0);
+    f32x8 dy1 = dy0 - 1;
+
+    u32x8 s = u32x8_set1(seed);
+    u32x8 x0 = (u32x8)ix0;
+    u32x8 y0 = u32x8_set1(iy0);
+    u32x8 h00 = lattice_hash(s, x0, y0);
+    u32x8 h10 = lattice_hash(s, x0 + 1, y0);
+    u32x8 h01 = lattice_hash(s, x0, y0 + 1);
+    u32x8 h11 = lattice_hash(s, x0 + 1, y0 + 1);
+
+    f32x8 fx = f32x8_smoothstep(dx0);
+    f32x8 fy = f32x8_smoothstep(dy0);
+    f32x8 xa = f32x8_lerp(gradient_dot(h00, dx0, dy0), gradient_dot(h10, dx1, dy0), fx);
+    f32x8 xb = f32x8_lerp(gradient_dot(h01, dx0, dy1), gradient_dot(h11, dx1, dy1), fx);
+    return f32x8_lerp(xa, xb, fy);
+}
+
+static f32x8 fbm8(f32x8 x, float y, FbmParams params) {
+    f32x8 sum = f32x8_set1(0);
+    float amplitude = 1;
+    float total_amplitude = 0;
+    float frequency = params.frequency;
+    for (int octave = 0; octave < params.octaves; ++octave) {
+        // Each octave gets its own lattice so they don't line up at the origin
+        f32x8 n = perlin_noise8(params.seed + octave, x * frequency, y * frequency);
+        switch (params.type) {
+            case FBM_STANDARD: break;
+            case FBM_RIDGED: n = 1 - f32x8_abs(n); n = n * n; break;
+            case FBM_TURBULENCE: n = f32x8_abs(n); break;
+        }
+        sum += n * amplitude;
+        total_amplitude += amplitude;
+        amplitude *= params.gain;
+        frequency *= params.lacunarity;
+    }
+    return sum / total_amplitude;
+}
+
+void fbm_row(float* out, int n, float x0, float y, FbmParams params) {
+    int i = 0;
+    for (; i + simd_width <= n; i += simd_width) {
+        f32x8_store(out + i, fbm8(f32x8_ramp(x0 + i, 1), y, params));
+    }
+
+    if (i < n) {
+        float tail[simd_width];
+        f32x8_store(tail, fbm8(f32x8_ramp(x0 + i, 1), y, params));
+        for (int l = 0; i + l < n; ++l) out[i + l] = tail[l];
+    }
+}
+
+void fbm_fill(float* out, int w, int h, float x0, float y0, FbmParams params) {
+    for (int y = 0; y < h; ++y) {
+        fbm_row(out + y * w, w, x0, y0 + y, params);
+    }
+}
+
+// Scalar and eight-lane types side by side, so simplex noise is written once as a template
+template <typename F>
+struct Lanes;
+
+template <>
+struct Lanes<float> {
+    typedef int I;
+    typedef uint32_t U;
+};
+
+template <>
+struct Lanes<f32x8> {
+    typedef i32x8 I;
+    typedef u32x8 U;
+};
+
+template <typename T>
+T splat(float a);
+
+template <>
+float splat<float>(float a) {
+    return a;
+}
+
+template <>
+f32x8 splat<f32x8>(float a) {
+    return f32x8_set1(a);
+}
+
+inline int floor_to_int(float a) {
+    return floor(a);
+}
+
+inline i32x8 floor_to_int(f32x8 a) {
+    return i32x8_floor(a);
+}
+
+inline float to_float(int a) {
+    return a;
+}
+
+inline f32x8 to_float(i32x8 a) {
+    return f32x8_from_i32x8(a);
+}
+
+inline float lanes_select(bool mask, float a, float b) {
+    return mask ? a : b;
+}
+
+inline f32x8 lanes_select(i32x8 mask, f32x8 a, f32x8 b) {
+    return mask ? a : b;
+}
+
+inline uint32_t lanes_select(bool mask, uint32_t a, uint32_t b) {
+    return mask ? a : b;
+}
+
+inline u32x8 lanes_select(i32x8 mask, u32x8 a, u32x8 b) {
+    return mask ? a : b;
+}
+
+// Contribution of one simplex corner at offset (x, y) from it. Gradients are the four diagonals.
+// The derivative of t^4 * (g . d) is -8 t^3 (g . d) d + t^4 g.
+template <typename F, typename U>
+void simplex2_corner(U hash, F x, F y, F& n, F& dx, F& dy) {
+    F gx = lanes_select((hash & 1) != 0, splat<F>(-1), splat<F>(1));
+    F gy = lanes_select((hash & 2) != 0, splat<F>(-1), splat<F>(1));
+    F t = 0.5f - x * x - y * y;
+    t = lanes_select(t > 0, t, splat<F>(0));
+    F t2 = t * t;
+    F t4 = t2 * t2;
+    F gd = gx * x + gy * y;
+    F a = -8.f * t2 * t * gd;
+    n += t4 * gd;
+    dx += a * x + t4 * gx;
+    dy += a * y + t4 * gy;
+}
+
+template <typename F>
+F simplex2(typename Lanes<F>::U seed, F x, F y, F& dx, F& dy) {
+    typedef typename Lanes<F>::U U;
+    const float f2 = 0.366025403f;  // (sqrt(3) - 1) / 2
+    const float g2 = 0.211324865f;  // (3 - sqrt(3)) / 6
+
+    // Skew to find the simplex cell, unskew to get the offset from its origin
+    F s = (x + y) * f2;
+    F i = to_float(floor_to_int(x + s));
+    F j = to_float(floor_to_int(y + s));
+    F t = (i + j) * g2;
+    F x0 = x - (i - t);
+    F y0 = y - (j - t);
+
+    // Lower or upper triangle of the cell
+    auto lower = x0 > y0;
+    F i1 = lanes_select(lower, splat<F>(1), splat<F>(0));
+    F j1 = 1.f - i1;
+
+    F x1 = x0 - i1 + g2;
+    F y1 = y0 - j1 + g2;
+    F x2 = x0 - 1.f + 2.f * g2;
+    F y2 = y0 - 1.f + 2.f * g2;
+
+    U ui = (U)floor_to_int(i);
+    U uj = (U)floor_to_int(j);
+    U ui1 = lanes_select(lower, ui + 1u, ui);
+    U uj1 = lanes_select(lower, uj, uj + 1u);
+
+    F n = splat<F>(0);
+    dx = splat<F>(0);
+    dy = splat<F>(0);
+    simplex2_corner(lattice_hash(seed, ui, uj), x0, y0, n, dx, dy);
+    simplex2_corner(lattice_hash(seed, ui1, uj1), x1, y1, n, dx, dy);
+    simplex2_corner(lattice_hash(seed, ui + 1u, uj + 1u), x2, y2, n, dx, dy);
+
+    const float scale = 70.f;
+    dx *= scale;
+    dy *= scale;
+    return n * scale;
+}
+
+// Same as the 2D corner with the eight cube diagonals as gradients. A radius of 0.6 is common
+// but leaves small discontinuities at the tetrahedron borders, 0.5 keeps it continuous.
+template <typename F, typename U>
+void simplex3_corner(U hash, F x, F y, F z, F& n, F& dx, F& dy, F& dz) {
+    F gx = lanes_select((hash & 1) != 0, splat<F>(-1), splat<F>(1));
+    F gy = lanes_select((hash & 2) != 0, splat<F>(-1), splat<F>(1));
+    F gz = lanes_select((hash & 4) != 0, splat<F>(-1), splat<F>(1));
+    F t = 0.5f - x * x - y * y - z * z;
+    t = lanes_select(t > 0, t, splat<F>(0));
+    F t2 = t * t;
+    F t4 = t2 * t2;
+    F gd = gx * x + gy * y + gz * z;
+    F a = -8.f * t2 * t * gd;
+    n += t4 * gd;
+    dx += a * x + t4 * gx;
+    dy += a * y + t4 * gy;
+    dz += a * z + t4 * gz;
+}
+
+template <typename F>
+F simplex3(typename Lanes<F>::U seed, F x, F y, F z, F& dx, F& dy, F& dz) {
+    typedef typename Lanes<F>::U U;
+    const float f3 = 1.f / 3;
+    const float g3 = 1.f / 6;
+
+    F s = (x + y + z) * f3;
+    F i = to_float(floor_to_int(x + s));
+    F j = to_float(floor_to_int(y + s));
+    F k = to_float(floor_to_int(z + s));
+    F t = (i + j + k) * g3;
+    F x0 = x - (i - t);
+    F y0 = y - (j - t);
+    F z0 = z - (k - t);
+
+    // Rank the offsets to pick one of the six tetrahedra without branching
+    auto xy = x0 >= y0;
+    auto yz = y0 >= z0;
+    auto xz = x0 >= z0;
+    auto i1 = xy && xz;
+    auto j1 = !xy && yz;
+    auto k1 = !xz && !yz;
+    auto i2 = xy || xz;
+    auto j2 = !xy || yz;
+    auto k2 = !xz || !yz;
+
+    F one = splat<F>(1);
+    F zero = splat<F>(0);
+    F x1 = x0 - lanes_select(i1, one, zero) + g3;
+    F y1 = y0 - lanes_select(j1, one, zero) + g3;
+    F z1 = z0 - lanes_select(k1, one, zero) + g3;
+    F x2 = x0 - lanes_select(i2, one, zero) + 2.f * g3;
+    F y2 = y0 - lanes_select(j2, one, zero) + 2.f * g3;
+    F z2 = z0 - lanes_select(k2, one, zero) + 2.f * g3;
+    F x3 = x0 - 1.f + 3.f * g3;
+    F y3 = y0 - 1.f + 3.f * g3;
+    F z3 = z0 - 1.f + 3.f * g3;
+
+    U ui = (U)floor_to_int(i);
+    U uj = (U)floor_to_int(j);
+    U uk = (U)floor_to_int(k);
+
+    F n = zero;
+    dx = zero;
+    dy = zero;
+    dz = zero;
+    simplex3_corner(lattice_hash(seed, ui, uj, uk), x0, y0, z0, n, dx, dy, dz);
+    simplex3_corner(lattice_hash(seed, lanes_select(i1, ui + 1u, ui), lanes_select(j1, uj + 1u, uj),
+                                 lanes_select(k1, uk + 1u, uk)),
+                    x1, y1, z1, n, dx, dy, dz);
+    simplex3_corner(lattice_hash(seed, lanes_select(i2, ui + 1u, ui), lanes_select(j2, uj + 1u, uj),
+                                 lanes_select(k2, uk + 1u, uk)),
+                    x2, y2, z2, n, dx, dy, dz);
+    simplex3_corner(lattice_hash(seed, ui + 1u, uj + 1u, uk + 1u), x3, y3, z3, n, dx, dy, dz);
+
+    const float scale = 62.f;
+    dx *= scale;
+    dy *= scale;
+    dz *= scale;
+    return n * scale;
+}
+
+float simplex_noise2(uint32_t seed, float x, float y, Vec2* gradient) {
+    float dx, dy;
+    float n = simplex2<float>(seed, x, y, dx, dy);
+    if (gradient) *gradient = {dx, dy};
+    return n;
+}
+
+float simplex_noise3(uint32_t seed, float x, float y, float z, Vec3* gradient) {
+    float dx, dy, dz;
+    float n = simplex3<float>(seed, x, y, z, dx, dy, dz);
+    if (gradient) *gradient = {dx, dy, dz};
+    return n;
+}
+
+void simplex2_row(float* out, Vec2* gradient, int n, float x0, float y, float scale, uint32_t seed) {
+    u32x8 s = u32x8_set1(seed);
+    f32x8 sy = f32x8_set1(y * scale);
+    for (int i = 0; i < n; i += simd_width) {
+        f32x8 dx, dy;
+        f32x8 v = simplex2<f32x8>(s, f32x8_ramp(x0 + i, 1) * scale, sy, dx, dy);
+
+        // Derivatives with respect to sample coordinates rather than noise coordinates
+        dx *= scale;
+        dy *= scale;
+        int lanes = n - i < simd_width ? n - i : simd_width;
+        for (int l = 0; l < lanes; ++l) {
+            out[i + l] = v[l];
+            if (gradient) gradient[i + l] = {dx[l], dy[l]};
+        }
+    }
+}
+
+void simplex3_row(float* out, Vec3* gradient, int n, float x0, float y, float z, float scale,
+                  uint32_t seed) {
+    u32x8 s = u32x8_set1(seed);
+    f32x8 sy = f32x8_set1(y * scale);
+    f32x8 sz = f32x8_set1(z * scale);
+    for (int i = 0; i < n; i += simd_width) {
+        f32x8 dx, dy, dz;
+        f32x8 v = simplex3<f32x8>(s, f32x8_ramp(x0 + i, 1) * scale, sy, sz, dx, dy, dz);
+        dx *= scale;
+        dy *= scale;
+        dz *= scale;
+        int lanes = n - i < simd_width ? n - i : simd_width;
+        for (int l = 0; l < lanes; ++l) {
+            out[i + l] = v[l];
+            if (gradient) gradient[i + l] = {dx[l], dy[l], dz[l]};
+        }
+    }
+}
@@ -1,6 +1,45 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
-float* create_perlin_grid(int ni, int nj, float scale);
+#include <stdint.h>
+
+#include "math.hpp"
+
+// Noise is a pure function of (seed, x, y): the same seed gives the same values on every run,
+// from any thread, for any sub-region. Chunks evaluated at integer offsets line up exactly.
+uint32_t noise_hash(uint32_t seed, int x, int y);
+float perlin_noise(uint32_t seed, float x, float y);
+float* create_perlin_grid(int ni, int nj, float scale, uint32_t seed);
+
+enum FbmType {
+    FBM_STANDARD,
+    FBM_RIDGED,      // 1 - |noise|, squared: sharp crests
+    FBM_TURBULENCE,  // |noise|: creases at zero crossings
+};
+
+struct FbmParams {
+    FbmType type = FBM_STANDARD;
+    int octaves = 4;
+    float frequency = 0.1;   // of the first octave, in cycles per sample
+    float lacunarity = 2;    // frequency multiplier between octaves
+    float gain = 0.5;        // amplitude multiplier between octaves
+    uint32_t seed = 0;
+};
+
+// Fractal noise summed over octaves and normalized by the total amplitude. Rows are evaluated
+// eight samples at a time. `out` holds `n` (or `w * h`) floats and is owned by the caller.
+void fbm_row(float* out, int n, float x0, float y, FbmParams params);
+void fbm_fill(float* out, int w, int h, float x0, float y0, FbmParams params);
+
+// Simplex noise in roughly [-1, 1]. `gradient` is optional and receives the analytic derivative,
+// e.g. for normals of a noise heightfield without finite differences.
+float simplex_noise2(uint32_t seed, float x, float y, Vec2* gradient);
+float simplex_noise3(uint32_t seed, float x, float y, float z, Vec3* gradient);
+
+// `n` samples at ((x0 + i) * scale, y * scale[, z * scale]), eight per iteration. `gradient` may be
+// NULL; when set it is the derivative with respect to the unscaled sample coordinates.
+void simplex2_row(float* out, Vec2* gradient, int n, float x0, float y, float scale, uint32_t seed);
+void simplex3_row(float* out, Vec3* gradient, int n, float x0, float y, float z, float scale,
+                  uint32_t seed);
 
 #endif /* PERLIN_H */
@@ -0,0 +1,86 @@
+#include "shadow.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+ShadowMask shadow_mask_create(int w, int h) {
+    return {
+        .w = w,
+        .h = h,
+        .data = (bool*)calloc(w * h, sizeof(bool)),
+    };
+}
+
+void shadow_mask_destroy(ShadowMask* m) {
+    free(m->data);
+}
+
+inline float pow8(float x) {
+    x *= x;
+    x *= x;
+    return x * x;
+}
+
+ShadowBounds shadow_bounds(Circle c, Vec3 sun_dir, float max_length) {
+    float r = c.radius;
+    float length = r;
+    if (sun_dir.z > 0) {
+        // For a ground point p = c - w, the distance from c to the ray p + t * sun is the vector
+        // (wx lz^2, wy, -wx lx lz). It is within r only if |wx| is below this, and the shadow falls
+        // on the side away from the sun.
+        length = fmaxf(r, fminf(r / (sun_dir.z * fmaxf(sun_dir.z, fabsf(sun_dir.x))), max_length));
+    }
+    float x0 = sun_dir.x > 0 ? c.center.x - length : c.center.x - r;
+    float x1 = sun_dir.x > 0 ? c.center.x + r : c.center.x + length;
+    return {{x0, c.center.y - r}, {x1, c.center.y + r}};
+}
+
+void shadow_mask_rasterize(ShadowMask* m, Affine world_to_mask, Vec3 sun_dir, float max_length, Circle* casters,
+                           int n_casters, ShadowShape shape) {
+    memset(m->data, 0, m->w * m->h * sizeof(bool));
+
+    // Sun below the horizon: nothing is lit directly, no shadow to draw
+    if (sun_dir.z <= 0) return;
+
+    Affine mask_to_world = inverse(world_to_mask);
+    Vec2 step = {mask_to_world.m.m00, mask_to_world.m.m10};
+    float lx = sun_dir.x;
+    float lz = sun_dir.z;
+
+    for (int i = 0; i < n_casters; ++i) {
+        Circle c = casters[i];
+        float r = c.radius;
+
+        // The sun is directional, unlike the point at distance 1000 the per-pixel test used
+        ShadowBounds bounds = shadow_bounds(c, sun_dir, max_length);
+        Vec2 top_left = multiply_affine_vec2(world_to_mask, bounds.min);
+        Vec2 bottom_right = multiply_affine_vec2(world_to_mask, bounds.max);
+        int px0 = clampi((int)floorf(top_left.x), 0, m->w);
+        int py0 = clampi((int)floorf(top_left.y), 0, m->h);
+        int px1 = clampi((int)ceilf(bottom_right.x), 0, m->w);
+        int py1 = clampi((int)ceilf(bottom_right.y), 0, m->h);
+
+        float r2 = r * r;
+        float r8 = pow8(r);
+        for (int y = py0; y < py1; ++y) {
+            Vec2 p = multiply_affine_vec2(mask_to_world, {(float)px0, (float)y});
+            bool* row = m->data + y * m->w;
+            for (int x = px0; x < px1; ++x, p = p + step) {
+                float wx = c.center.x - p.x;
+                float wy = c.center.y - p.y;
+
+                // The caster's own footprint is lit from above
+                if (wx * wx + wy * wy < r2) continue;
+
+                // Caster must sit between the point and the sun
+                if (wx * lx <= 0) continue;
+
+                float dx = wx * lz * lz;
+                float dz = wx * lx * lz;
+                bool inside = shape == SHADOW_BOXY ? pow8(dx) + pow8(wy) + pow8(dz) < r8
+                                                   : dx * dx + wy * wy + dz * dz < r2;
+                if (inside) row[x] = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef SHADOW_HPP
+#define SHADOW_HPP
+
+#include "math.hpp"
+#include "visibility.hpp"
+
+enum ShadowShape {
+    SHADOW_ROUND,  // casters are spheres
+    SHADOW_BOXY,   // 8-norm "sphere", square shadows that suit more kinds of objects
+};
+
+struct ShadowMask {
+    int w;
+    int h;
+    bool* data;
+};
+
+struct ShadowBounds {
+    Vec2 min;
+    Vec2 max;
+};
+
+// Ground area that can be darkened by the caster, footprint included. Shadows of a low sun are
+// cut at `max_length`.
+ShadowBounds shadow_bounds(Circle c, Vec3 sun_dir, float max_length);
+
+ShadowMask shadow_mask_create(int w, int h);
+void shadow_mask_destroy(ShadowMask* m);
+
+// Projects each caster, resting on the ground plane z = 0, along the direction to the sun and
+// marks the covered pixels. `world_to_mask` maps ground coordinates to mask pixels and must be a
+// scale plus translation. Shadows are cut at `max_length` ground units, as in shadow_bounds. Cost
+// is proportional to the shadow area on the mask.
+void shadow_mask_rasterize(ShadowMask* m, Affine world_to_mask, Vec3 sun_dir, float max_length, Circle* casters,
+                           int n_casters, ShadowShape shape);
+
+#endif /* SHADOW_HPP */
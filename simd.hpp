@@ -0,0 +1,86 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+// Eight float/int lanes using GCC vector extensions. With AVX enabled each operation maps to a
+// single instruction, otherwise the compiler splits it into narrower ones.
+typedef float f32x8 __attribute__((vector_size(32)));
+typedef int i32x8 __attribute__((vector_size(32)));
+typedef unsigned int u32x8 __attribute__((vector_size(32)));
+
+const int simd_width = 8;
+
+inline f32x8 f32x8_set1(float a) {
+    return f32x8{a, a, a, a, a, a, a, a};
+}
+
+inline i32x8 i32x8_set1(int a) {
+    return i32x8{a, a, a, a, a, a, a, a};
+}
+
+inline u32x8 u32x8_set1(unsigned int a) {
+    return u32x8{a, a, a, a, a, a, a, a};
+}
+
+// a, a + step, a + 2 * step, ...
+inline f32x8 f32x8_ramp(float a, float step) {
+    return f32x8{0, 1, 2, 3, 4, 5, 6, 7} * step + a;
+}
+
+inline f32x8 f32x8_from_i32x8(i32x8 a) {
+    return __builtin_convertvector(a, f32x8);
+}
+
+inline i32x8 i32x8_floor(f32x8 a) {
+    i32x8 i = __builtin_convertvector(a, i32x8);
+    // Truncation rounds negative values up, comparison masks are -1 where true
+    return i + (f32x8_from_i32x8(i) > a);
+}
+
+inline f32x8 f32x8_abs(f32x8 a) {
+    return a < 0 ? -a : a;
+}
+
+inline f32x8 f32x8_sqrt(f32x8 a) {
+#ifdef __AVX__
+    return (f32x8)_mm256_sqrt_ps((__m256)a);
+#else
+    for (int l = 0; l < simd_width; ++l) a[l] = __builtin_sqrtf(a[l]);
+    return a;
+#endif
+}
+
+inline f32x8 f32x8_min(f32x8 a, f32x8 b) {
+    return a < b ? a : b;
+}
+
+inline f32x8 f32x8_max(f32x8 a, f32x8 b) {
+    return a > b ? a : b;
+}
+
+inline f32x8 f32x8_clamp(f32x8 a, float lo, float hi) {
+    return f32x8_min(f32x8_max(a, f32x8_set1(lo)), f32x8_set1(hi));
+}
+
+inline f32x8 f32x8_lerp(f32x8 a, f32x8 b, f32x8 f) {
+    return a + f * (b - a);
+}
+
+inline f32x8 f32x8_smoothstep(f32x8 x) {
+    return x * x * (3 - 2 * x);
+}
+
+inline f32x8 f32x8_load(const float* p) {
+    f32x8 a;
+    __builtin_memcpy(&a, p, sizeof(a));
+    return a;
+}
+
+inline void f32x8_store(float* p, f32x8 a) {
+    __builtin_memcpy(p, &a, sizeof(a));
+}
+
+#endif /* SIMD_HPP */
@@ -0,0 +1,84 @@
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const size_t snapshot_alignment = 64;
+
+uint64_t snapshot_append(SnapshotWriter* w, const void* data, size_t size) {
+    size_t offset = (w->size + snapshot_alignment - 1) & ~(snapshot_alignment - 1);
+    if (offset + size > w->capacity) {
+        w->capacity = offset + size > 2 * w->capacity ? offset + size : 2 * w->capacity;
+        w->data = (char*)realloc(w->data, w->capacity);
+    }
+    memset(w->data + w->size, 0, offset - w->size);
+    memcpy(w->data + offset, data, size);
+    w->size = offset + size;
+    return offset;
+}
+
+void snapshot_writer_destroy(SnapshotWriter* w) {
+    free(w->data);
+    *w = {};
+}
+
+bool snapshot_write_file(SnapshotWriter* w, const char* path) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    // Regular files take everything in one write unless something is wrong
+    bool ok = write(fd, w->data, w->size) == (ssize_t)w->size;
+    ok = close(fd) == 0 && ok;
+    if (ok) ok = rename(tmp_path, path) == 0;
+    if (!ok) unlink(tmp_path);
+    return ok;
+}
+
+bool snapshot_map(const char* path, MappedFile* f) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    f->data = (char*)data;
+    f->size = st.st_size;
+    return true;
+}
+
+void snapshot_unmap(MappedFile* f) {
+    if (f->data) munmap(f->data, f->size);
+    *f = {};
+}
+
+// Word at a time multiply-xorshift, fast enough to check a whole world on load
+uint64_t snapshot_checksum(const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    const uint64_t k = 0xff51afd7ed558ccdull;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * k;
+        h ^= h >> 32;
+    }
+    for (; i < size; ++i) {
+        h = (h ^ p[i]) * k;
+        h ^= h >> 32;
+    }
+    return h;
+}
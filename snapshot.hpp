@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Snapshot files are built in memory as a list of sections and written with a single write. They
+// are read back by mapping the file, so sections are used in place and pages fault in on use.
+// Sections start on 64 byte boundaries.
+struct SnapshotWriter {
+    char* data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+// Copies `size` bytes to the end of the snapshot and returns the offset they start at
+uint64_t snapshot_append(SnapshotWriter* w, const void* data, size_t size);
+void snapshot_writer_destroy(SnapshotWriter* w);
+
+// Writes to a temporary file then renames it over `path`, so a reader never sees a partial file and
+// an existing mapping of the old file stays valid.
+bool snapshot_write_file(SnapshotWriter* w, const char* path);
+
+struct MappedFile {
+    char* data = NULL;
+    size_t size = 0;
+};
+
+// Private writable mapping: writes go to memory, never to the file. Returns false if the file can't
+// be opened or mapped.
+bool snapshot_map(const char* path, MappedFile* f);
+void snapshot_unmap(MappedFile* f);
+
+uint64_t snapshot_checksum(const void* data, size_t size);
+
+#endif /* SNAPSHOT_HPP */
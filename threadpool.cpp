@@ -0,0 +1,110 @@
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    bool stop = false;
+
+    // Current batch, `generation` changes whenever a new one starts
+    int generation = 0;
+    TaskFunction f = nullptr;
+    void* data = nullptr;
+    int n_tasks = 0;
+    std::atomic<int> next_task{0};
+    int n_finished = 0;  // workers done with the current batch
+
+    // Joins the workers at exit if nobody called thread_pool_shutdown
+    ~ThreadPool();
+};
+
+static ThreadPool pool;
+
+// Takes tasks from the current batch until none are left
+static void run_tasks(TaskFunction f, void* data, int n_tasks) {
+    while (true) {
+        int task = pool.next_task.fetch_add(1);
+        if (task >= n_tasks) break;
+        f(task, data);
+    }
+}
+
+static void worker_loop() {
+    int seen_generation = 0;
+    while (true) {
+        TaskFunction f;
+        void* data;
+        int n_tasks;
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.work_ready.wait(lock, [&] { return pool.stop || pool.generation != seen_generation; });
+            if (pool.stop) return;
+            seen_generation = pool.generation;
+            f = pool.f;
+            data = pool.data;
+            n_tasks = pool.n_tasks;
+        }
+
+        run_tasks(f, data, n_tasks);
+
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (++pool.n_finished == (int)pool.workers.size()) pool.work_done.notify_one();
+    }
+}
+
+void thread_pool_init(int n_threads) {
+    if (n_threads <= 0) n_threads = std::thread::hardware_concurrency();
+    // The calling thread works too
+    for (int i = 1; i < n_threads; ++i) pool.workers.emplace_back(worker_loop);
+}
+
+void thread_pool_shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stop = true;
+    }
+    pool.work_ready.notify_all();
+    for (std::thread& t : pool.workers) t.join();
+    pool.workers.clear();
+    pool.stop = false;
+}
+
+ThreadPool::~ThreadPool() {
+    thread_pool_shutdown();
+}
+
+int thread_pool_size() {
+    return pool.workers.size() + 1;
+}
+
+void thread_pool_run(int n_tasks, TaskFunction f, void* data) {
+    if (pool.workers.empty()) {
+        for (int i = 0; i < n_tasks; ++i) f(i, data);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.f = f;
+        pool.data = data;
+        pool.n_tasks = n_tasks;
+        pool.next_task = 0;
+        pool.n_finished = 0;
+        pool.generation++;
+    }
+    pool.work_ready.notify_all();
+
+    run_tasks(f, data, n_tasks);
+
+    // Every worker checks in for every batch, even late ones that find no task left, so none of them
+    // can still be looking at `data` once this returns
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.work_done.wait(lock, [] { return pool.n_finished == (int)pool.workers.size(); });
+}
@@ -0,0 +1,15 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+typedef void (*TaskFunction)(int task, void* data);
+
+// Fixed set of worker threads shared by the whole program. `n_threads` 0 uses one per core.
+void thread_pool_init(int n_threads);
+void thread_pool_shutdown();
+int thread_pool_size();
+
+// Calls `f(i, data)` for every i in [0, n_tasks) on the workers and the calling thread, and returns
+// once all of them are done. Tasks are handed out in order but may finish in any order.
+void thread_pool_run(int n_tasks, TaskFunction f, void* data);
+
+#endif /* THREADPOOL_HPP */
@@ -0,0 +1,57 @@
+#include "visibility.hpp"
+
+#include <stdlib.h>
+
+AngularDepth angular_depth_create(int n_bins) {
+    AngularDepth a;
+    a.n = n_bins;
+    a.max_distance = 0;
+    a.depth = (float*)malloc(n_bins * sizeof(float));
+    return a;
+}
+
+void angular_depth_destroy(AngularDepth* a) {
+    free(a->depth);
+    a->n = 0;
+}
+
+// Sweeps each occluder over the bins it covers, keeping the nearest hit per bin. Cost is the sum of
+// angular sizes of the occluders, independent of how many pixels are lit afterwards.
+void angular_depth_compute(AngularDepth* a, Vec2 origin, float max_distance, Circle* occluders, int n_occluders) {
+    a->origin = origin;
+    a->max_distance = max_distance;
+    for (int i = 0; i < a->n; ++i) a->depth[i] = max_distance;
+
+    const float bin_angle = 2 * M_PI / a->n;
+    for (int i = 0; i < n_occluders; ++i) {
+        Circle c = occluders[i];
+        Vec2 to_center = c.center - origin;
+        float distance = vec2_norm(to_center);
+        if (distance - c.radius >= max_distance) continue;
+
+        if (distance <= c.radius) {
+            // Origin inside the occluder, everything is hidden
+            for (int b = 0; b < a->n; ++b) a->depth[b] = 0;
+            return;
+        }
+
+        float center_angle = atan2f(to_center.y, to_center.x);
+        float half_width = asinf(c.radius / distance);
+        int b0 = (int)floorf((center_angle - half_width + (float)M_PI) / bin_angle);
+        int b1 = (int)ceilf((center_angle + half_width + (float)M_PI) / bin_angle);
+
+        for (int b = b0; b <= b1; ++b) {
+            int bin = ((b % a->n) + a->n) % a->n;
+
+            // Entry point of the ray through the middle of the bin, or the closest approach for
+            // bins that only graze the circle
+            float angle = (bin + 0.5f) * bin_angle - (float)M_PI;
+            Vec2 ray = {cosf(angle), sinf(angle)};
+            float along = vec2_dot(to_center, ray);
+            float perp2 = distance * distance - along * along;
+            float r2 = c.radius * c.radius;
+            float hit = perp2 < r2 ? along - sqrtf(r2 - perp2) : along;
+            if (along > 0 && hit < a->depth[bin]) a->depth[bin] = hit;
+        }
+    }
+}
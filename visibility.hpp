@@ -0,0 +1,35 @@
+#ifndef VISIBILITY_HPP
+#define VISIBILITY_HPP
+
+#include "math.hpp"
+
+struct Circle {
+    Vec2 center;
+    float radius;
+};
+
+// Visibility polygon around an origin, stored as the distance to the first occluder for each of
+// `n` equal angle bins. Bins with nothing in the way hold `max_distance`.
+struct AngularDepth {
+    int n = 0;
+    Vec2 origin;
+    float max_distance;
+    float* depth;
+};
+
+AngularDepth angular_depth_create(int n_bins);
+void angular_depth_destroy(AngularDepth* a);
+void angular_depth_compute(AngularDepth* a, Vec2 origin, float max_distance, Circle* occluders, int n_occluders);
+
+inline int angular_depth_bin(AngularDepth* a, Vec2 direction) {
+    float angle = atan2f(direction.y, direction.x);
+    int bin = (int)((angle + (float)M_PI) * (a->n / (2 * (float)M_PI)));
+    return bin < a->n ? bin : 0;
+}
+
+inline bool angular_depth_visible(AngularDepth* a, Vec2 p) {
+    Vec2 d = p - a->origin;
+    return vec2_norm(d) < a->depth[angular_depth_bin(a, d)];
+}
+
+#endif /* VISIBILITY_HPP */
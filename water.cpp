@@ -62,9 +62,9 @@ void water_add(int x, int y, int width, int height) {
         int xi = i % width;
         int yi = i / width;
         int world_xy = (y + yi) * world_x + (x + xi);
-        ground.mat[world_xy] = WATER;
-        rendering.normal[world_xy] = {0, 0, 1};
-        rendering.albedo[world_xy] = {0, 0, 1};
+        chunk_grid_set(&ground.mat, x + xi, y + yi, WATER);
+        rendering.normal[world_xy] = normal_encode({0, 0, 1});
+        rendering.albedo[world_xy] = albedo_encode({0, 0, 1});
     }
 
     w->heightmap[10 * width + 1] = 3;
@@ -111,7 +111,7 @@ void water_update(float dt) {
                 float nx = (h[x1y] - h[x0y]) / 2;
                 float ny = (h[xy1] - h[xy0]) / 2;
                 Vec3 normal = vec3_normalize({nx, ny, 1});
-                rendering.normal[world_xy] = normal;
+                rendering.normal[world_xy] = normal_encode(normal);
             }
         }
 
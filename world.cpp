@@ -1,10 +1,27 @@
 #include "world.hpp"
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <thread>
 
 #include "gfx.hpp"
 #include "image.hpp"
+#include "broadphase.hpp"
+#include "chunkgrid.hpp"
+#include "entity.hpp"
+#include "flowfield.hpp"
+#include "fov.hpp"
+#include "gbuffer.hpp"
 #include "math.hpp"
+#include "pathfinding.hpp"
+#include "perlin.h"
+#include "shadow.hpp"
+#include "snapshot.hpp"
+#include "threadpool.hpp"
 #include "utility.hpp"
+#include "visibility.hpp"
 
 struct Camera {
     Vec2 position;  // offset from game grid top-left (0,0)
@@ -24,12 +41,20 @@ struct Camera {
 
 enum ShapeType {
     CIRCLE,
+    BOX,
+    CAPSULE,
 };
 
 struct Shape {
     ShapeType type;
-    float radius;
+    float radius;  // of the bounding circle, used for collisions, shadows and culling
     RGBA color;
+    Vec2 size;     // BOX: half extents, CAPSULE: half length of the segment along x and thickness
+};
+
+enum Behavior : uint8_t {
+    BEHAVIOR_NONE,
+    BEHAVIOR_SEEK_PLAYER,  // follows creature_flow
 };
 
 struct Controls {
@@ -40,11 +65,12 @@ struct Controls {
     Vec2 mouse;
 };
 
-enum GroundType {
+enum GroundType : uint8_t {
     NONE,
     GRASS,
     DIRT,
     WATER,
+    MUD,
 };
 
 struct GroundSample {
@@ -64,31 +90,83 @@ struct Torch {
     Vec2 direction;
 };
 
+enum LightType {
+    POINT_LIGHT,
+    SPOT_LIGHT,
+};
+
+// Light on the ground plane, falling off to nothing at `radius`. Spot lights are also limited to
+// the cone around `direction`, fading between the outer and inner cosines.
+struct Light {
+    LightType type;
+    Vec2 position;
+    float height;  // above the ground, for the normal term
+    float radius;
+    Vec3 color;    // times intensity
+    Vec2 direction;
+    float cos_inner;
+    float cos_outer;
+};
+
+// Lights or entities overlapping each shading tile, tile t uses index[offset[t] .. offset[t + 1]]
+struct TileBins {
+    int n_tiles = 0;
+    int tiles_capacity = 0;
+    int* offset = NULL;
+    int index_capacity = 0;
+    int* index = NULL;
+};
+
+// Screen-space rectangle [x0, x1) x [y0, y1)
+struct ScreenRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+};
+
+// Sparse, see chunkgrid.hpp, so the world size is bounded by the dense buffers instead
 struct Ground {
-    GroundType *mat;
+    ChunkGrid mat;  // GroundType
 };
 
+// See gbuffer.hpp for the encodings
 struct RenderingBuffer {
-    Vec3 *normal;
-    Vec3 *albedo;
+    uint32_t *normal;
+    uint32_t *albedo;
 };
 
-const int max_items = 1024;
-
-const int world_x = 1000;
-const int world_y = 1000;
-const int world_size = world_x * world_y;
-Vec2 position[max_items];
-Vec2 velocity[max_items];
-Shape shape[max_items];
-int n_ids = 0;
+// Set once by world_init, along with the grid sizes derived from them below
+int world_x;
+int world_y;
+int world_size;
+
+// Zeroed buffer of n elements covering the whole world. There's no running without one, so a
+// failure is reported and ends the program.
+void* world_calloc(size_t n, size_t size) {
+    void* p = calloc(n, size);
+    if (!p) {
+        printf("world: out of memory for a %dx%d world, %zu MB buffer\n", world_x, world_y, n * size >> 20);
+        abort();
+    }
+    return p;
+}
+// Components of live entities, packed and indexed by entity_index(&entities, handle)
+EntitySlots entities;
+int components_capacity = 0;
+Vec2* position;
+Vec2* velocity;
+Shape* shape;
+Behavior* behavior;
+Circle* entity_circle;  // bounding circle of each entity, see entity_circles()
 Controls controls;
-int controlling;
+Entity controlling;
 unsigned long time_ms;
 float time_scaling = 500;
 float ms_accumulated;
 float start_time_hours = 9.f;
 Camera camera;
+Camera view;  // camera at the internal render resolution, see DynamicResolution
 Image texture[10];
 Sun sun;
 Torch torch;
@@ -99,6 +177,344 @@ const int max_ground_sample = 128;
 int n_ground_sample = 0;
 GroundSample ground_sample[max_ground_sample];
 
+// Only the nearest samples are blended: with weights falling off as 1/d^8 the rest contribute
+// next to nothing, and it bounds the region a new sample can change.
+const int ground_k_nearest = 8;
+const int ground_bucket_size = 32;
+int ground_buckets_x;
+int ground_buckets_y;
+const int ground_tile_size = 16;
+int ground_tiles_x;
+int ground_tiles_y;
+const uint32_t ground_seed = 0x9e0d;
+
+// Uniform grid over the ground samples, bucket b holds samples[offset[b] .. offset[b + 1]]
+struct GroundIndex {
+    int* offset;  // ground_buckets_x * ground_buckets_y + 1
+    int samples[max_ground_sample];
+};
+
+struct GroundNeighbours {
+    int n = 0;
+    int sample[ground_k_nearest];
+    float distance[ground_k_nearest];  // sorted, nearest first
+};
+
+GroundIndex ground_index;
+
+// Torch intensity per screen pixel, rebuilt once per frame
+const int torch_angle_bins = 1024;
+const float torch_max_distance = 50;
+const float torch_min_dot = 0.8;
+AngularDepth torch_visibility;
+int torch_occluders_capacity = 0;
+Circle* torch_occluders;
+float* torch_buffer;
+ScreenRect torch_lit;
+
+// world_draw shades the screen in tiles of this many pixels on the thread pool
+const int draw_tile_size = 64;
+
+// Point and spot lights, packed and indexed like entities
+EntitySlots light_slots;
+int lights_capacity = 0;
+Light* lights;
+Circle* light_circle;  // reach of each light, for binning
+TileBins light_bins;
+TileBins entity_bins;
+TileBins scenery_bins;
+// Scenery in view this frame, bins index these
+int scenery_visible_capacity = 0;
+int* scenery_visible;
+Circle* scenery_visible_circle;
+// Entities the player can see this frame, same
+int entity_seen_capacity = 0;
+int* entity_seen;
+Circle* entity_seen_circle;
+
+struct ShadeParams {
+    Affine t;
+    Affine ti;
+    Img* fb;
+    int tiles_x;
+    int level;  // of ground_mips
+    Vec3 entity_light;
+};
+
+// Scales the internal render resolution to keep shading under a frame budget, the result is
+// upscaled into the framebuffer. Shading cost is proportional to the pixel count, so the scale
+// moves towards sqrt(target / measured).
+struct DynamicResolution {
+    float scale = 1;
+    float min_scale = 0.5;
+    float target_ms = 8;
+    float smoothed_ms = 0;
+    Img scene;  // full resolution allocation, w and h track the internal resolution
+};
+
+// Ground lit by the sun and ambient light, cached in world space per texel as RGB8. Tiles are
+// relit lazily when visible, so panning the camera only resamples the cache.
+const int light_cache_tile_size = 32;
+int light_cache_tiles_x;
+int light_cache_tiles_y;
+const float light_cache_min_sun_delta = 0.01;  // radians
+const float light_cache_sun_interval = 1;      // real seconds between relights as the sun moves
+const float shadow_max_length = 200;
+const Vec3 ambient_light = {0.1, 0.1, 0.1};
+
+struct LightCache {
+    uint32_t* color;
+    bool* valid;  // per tile
+    float sun_angle;
+    // Casters as they were when the cache was lit, to find the ones that moved
+    int n_casters;
+    int casters_capacity;
+    Circle* casters;
+};
+
+// Mip pyramid of the G-buffer and light cache for zoomed out frames: level l texels cover 2^l
+// world texels. Colors are averaged, so the lit level also holds the fraction in shadow, and
+// normals are renormalized. Level 0 points at the full resolution buffers. The top level fits
+// in a light cache tile, so relighting a tile only touches its own mip texels.
+const int ground_mip_levels = 5;
+
+struct GroundMips {
+    int w[ground_mip_levels];
+    int h[ground_mip_levels];
+    uint32_t* albedo[ground_mip_levels];
+    uint32_t* normal[ground_mip_levels];
+    uint32_t* lit[ground_mip_levels];
+};
+
+// Static scenery, placed once and never moved, is kept out of the per-frame entity passes. It is
+// sorted by grid cell, cell c holding scenery [offset[c], offset[c + 1]), and its sun shadows are
+// baked per light cache tile, rebaked only when the sun has moved since.
+const int scenery_cell_size = 8;
+int scenery_cells_x;
+int scenery_cells_y;
+const float scenery_min_distance = 2.5;  // Poisson-disk radius, about 100k trees per 1000x1000
+const float scenery_max_radius = 1.2;
+const float scenery_clearing = 12;      // around the player's start
+const uint32_t scenery_seed = 0x7ee5;
+
+struct Scenery {
+    int n;
+    Vec2* position;
+    Shape* shape;
+    int* offset;   // scenery_cells_x * scenery_cells_y + 1
+    bool* shadow;  // world texels, shadowed by scenery
+    float* shadow_angle;  // per light cache tile, sun angle baked, NAN if none
+};
+
+struct RelightParams {
+    int* tiles;
+    float sun_angle;
+    Vec3 sun_vec;
+    Vec3 sun_color;
+    Circle* casters;
+    int n_casters;
+};
+
+// Indirect light on a coarse grid over the ground. Cells inject the light their ground reflects
+// (sun from the light cache, torch and lights each frame) and radiance spreads to the four
+// neighbours a few iterations per frame, damped by the entities standing in a cell. Sampled
+// bilinearly as ambient, it converges over frames instead of being solved each frame.
+const int indirect_cell_size = 8;
+int indirect_x;
+int indirect_y;
+const int indirect_iterations = 4;        // per frame
+const int indirect_rows_per_frame = 8;    // of sun injection, refreshed round-robin
+const float indirect_transfer = 0.75;     // fraction of a neighbour's light passed on
+const float indirect_strength = 0.1;
+
+// Arrays of indirect_x * indirect_y cells
+struct IndirectLight {
+    Vec3* sun_inject;       // reflected sun and ambient, from the light cache
+    Vec3* inject;           // all reflected light this frame
+    float* transmit;        // 1 - entity coverage
+    float* static_transmit; // 1 - scenery coverage
+    Vec3* radiance[2];      // light arriving from neighbours, ping-ponged
+    Vec3* exitant;          // light leaving a cell in an iteration
+    int current;
+    int next_row;
+};
+
+// The ground is generated on a background thread in tiles, nearest to the camera first, into
+// staging buffers. The main thread copies finished tiles in and shows placeholder material for
+// the rest, so the first frame doesn't wait for the whole world. The scenery is scattered first,
+// on the same thread, and swapped in whole. A tile is a chunk of the ground, so the worker never
+// allocates cells of a chunk the main thread is copying.
+const int generation_tile_size = chunk_size;
+int generation_tiles_x;
+int generation_tiles_y;
+int generation_tiles;
+
+enum GenerationState : uint8_t {
+    TILE_PENDING,
+    TILE_GENERATED,  // in the staging buffers, written by the worker
+    TILE_DONE,       // copied in by the main thread
+};
+
+struct GroundGeneration {
+    std::thread worker;
+    bool running = false;
+    std::atomic<bool> stop{false};
+    std::atomic<int> focus_x{0};  // generation tile the camera looks at
+    std::atomic<int> focus_y{0};
+    std::atomic<uint8_t>* state;  // per tile
+    int n_done = 0;
+    std::chrono::high_resolution_clock::time_point start;
+    // Staging, same layout as the live buffers
+    ChunkGrid mat;
+    uint32_t* normal;
+    uint32_t* albedo;
+    Scenery* scenery;
+    std::atomic<bool> scenery_ready{false};
+    Hpa paths;  // built by the worker once the ground is complete
+    std::atomic<bool> paths_ready{false};
+
+    // Stops the worker at exit if generation hasn't finished
+    ~GroundGeneration();
+};
+
+// Grass spreads over damp dirt, water seeps into the ground around it as mud, and mud dries back
+// to dirt. Steps at a fixed rate over the chunks where a cell can still change. Each chunk writes
+// its next state to its own buffers, reading the current one, so chunks step in parallel.
+const int dynamics_chunk_size = 32;
+int dynamics_chunks_x;
+int dynamics_chunks_y;
+int dynamics_chunks;
+const float dynamics_step_seconds = 0.1;
+const uint32_t dynamics_seed = 0xd1ab;
+const uint8_t moisture_falloff = 40;   // lost per cell away from water
+const uint8_t moisture_drying = 1;     // lost per step away from water
+const uint8_t mud_wet = 135;           // grass and dirt this wet turn to mud
+const uint8_t mud_dry = 100;           // mud drier than this turns to dirt
+const uint8_t grass_moisture = 20;     // grass only spreads over dirt this damp
+const uint32_t grass_spread_chance = 1u << 28;  // out of 2^32, per step and cell
+const uint32_t water_evaporate_chance = 1u << 26;  // for water at the edge of a pool
+
+enum DynamicsWake : uint8_t {
+    WAKE_LEFT = 1,
+    WAKE_RIGHT = 2,
+    WAKE_TOP = 4,
+    WAKE_BOTTOM = 8,
+};
+
+struct DynamicsChunk {
+    bool active;
+    GroundType* mat;    // next step, allocated on the first one
+    uint8_t* moisture;
+    // Results of the last step
+    bool mat_changed;
+    bool water_changed; // walkability too
+    bool busy;          // some cell can still change
+    uint8_t wake;       // DynamicsWake, neighbours with a changed cell next to them
+};
+
+struct GroundDynamics {
+    bool running = false;
+    float accumulated = 0;
+    uint32_t step = 0;
+    ChunkGrid moisture;  // world cells, 255 in water
+    DynamicsChunk* chunks;
+    int n_active = 0;
+    int* active;
+};
+
+// Saved world, see world_snapshot_save. Bump the version whenever anything saved changes layout,
+// older snapshots are then ignored and the world regenerated.
+const uint32_t snapshot_magic = 0x444c5257;  // "WRLD"
+const uint32_t snapshot_version = 7;
+const char* world_snapshot_path = "world.snapshot";
+
+// EntitySlots arrays, as offsets into the snapshot
+struct SnapshotSlots {
+    int32_t n;
+    int32_t capacity;
+    int32_t free_head;
+    uint64_t generation;
+    uint64_t dense;
+    uint64_t slot;
+    uint64_t next_free;
+};
+
+// ChunkGrid, as offsets into the snapshot. Chunk c's cells are at cells + index[c] * chunk cells,
+// uniform chunks have index -1.
+struct SnapshotChunks {
+    uint64_t uniform;
+    uint64_t index;
+    uint64_t cells;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t checksum;  // of the file from `size` up to `in_place`
+    uint64_t size;
+    uint64_t in_place;  // start of the sections used in place
+    int32_t world_x;
+    int32_t world_y;
+
+    uint64_t time_ms;
+    float sun_angle;
+    Vec2 camera_position;
+    float camera_size_x;
+    float camera_size_y;
+
+    SnapshotSlots entities;
+    Entity controlling;
+    uint64_t position;
+    uint64_t velocity;
+    uint64_t shape;
+    uint64_t behavior;
+    SnapshotSlots light_slots;
+    uint64_t lights;
+    int32_t n_ground_sample;
+    uint64_t ground_sample;
+    uint64_t explored;
+    SnapshotChunks moisture;
+    SnapshotChunks mat;
+
+    // Used in place from the mapping, per mip level, level 0 is the G-buffer. They are left out of
+    // the checksum so that loading only faults in the pages that get drawn.
+    uint64_t normal[ground_mip_levels];
+    uint64_t albedo[ground_mip_levels];
+};
+
+Broadphase broadphase;
+DynamicResolution dynamic_resolution;
+ShadowShape sun_shadow_shape = SHADOW_BOXY;
+LightCache light_cache;
+Scenery scenery;
+GroundMips ground_mips;
+GroundGeneration ground_generation;
+GroundDynamics ground_dynamics;
+MappedFile world_snapshot;  // backs the G-buffer after a load
+// Pathfinding over ground.mat with the cells under trees marked, empty until generation finishes
+const uint8_t path_scenery = 8;  // past every GroundType
+const float path_agent_radius = 1;  // the player's
+uint8_t* path_cells;
+Hpa ground_paths;
+// Where creatures go, recomputed as the player moves. Beyond the radius they don't know.
+FlowFieldWorker creature_flow;
+const int creature_flow_radius = 96;
+const float creature_speed = 18;
+const float creature_keep_distance = 3;  // to the player, center to center
+// What the player sees. Trees block sight, and so do creatures where they stand.
+const int sight_radius = 40;
+const float sight_explored_light = 0.35;  // explored ground out of sight is drawn this dark
+uint8_t* sight_trees;
+Fov sight;
+PathCell* sight_movers;
+int sight_movers_capacity = 0;
+// Cells the player walks through after a right click, see world_update
+const int max_player_path = 4096;
+PathCell player_path[max_player_path];
+int player_path_n = 0;
+int player_path_next = 0;
+IndirectLight indirect;
+
 
 float get_time_of_day() {
     int ms_in_hour = 3600 * 1000;
@@ -187,24 +603,281 @@ Image texture_dirt_create() {
     return t;
 }
 
-int new_id() {
-    assert(n_ids < max_items);
-    return n_ids++;
+Image texture_mud_create() {
+    Image t = image_create(30, 30);
+
+    for (int i = 0; i < 900; ++i) {
+        RGBA c = rgba_from_hex(0x4a3728);
+        RGBA noise = randf() * 0.03 * RGBA{1, 1, 1, 1};
+        t.data[i] = c + noise;
+    }
+
+    return t;
+}
+
+Image texture_water_create() {
+    Image t = image_create(30, 30);
+
+    for (int i = 0; i < 900; ++i) {
+        RGBA c = rgba_from_hex(0x2a6f97);
+        RGBA noise = randf() * 0.02 * RGBA{1, 1, 1, 1};
+        t.data[i] = c + noise;
+    }
+
+    return t;
+}
+
+Entity new_entity() {
+    Entity e = entity_create(&entities);
+    if (entities.capacity > components_capacity) {
+        components_capacity = entities.capacity;
+        position = (Vec2*)realloc(position, components_capacity * sizeof(Vec2));
+        velocity = (Vec2*)realloc(velocity, components_capacity * sizeof(Vec2));
+        shape = (Shape*)realloc(shape, components_capacity * sizeof(Shape));
+        behavior = (Behavior*)realloc(behavior, components_capacity * sizeof(Behavior));
+        entity_circle = (Circle*)realloc(entity_circle, components_capacity * sizeof(Circle));
+    }
+
+    int id = entities.n - 1;
+    position[id] = {};
+    velocity[id] = {};
+    shape[id] = {};
+    behavior[id] = BEHAVIOR_NONE;
+    return e;
 }
 
-int add_player() {
-    int id = new_id();
+void remove_entity(Entity e) {
+    int id = entity_destroy(&entities, e);
+    if (id < 0) return;
+
+    int last = entities.n;
+    position[id] = position[last];
+    velocity[id] = velocity[last];
+    shape[id] = shape[last];
+    behavior[id] = behavior[last];
+}
+
+// Refreshes and returns the bounding circles of all entities, in entity order
+Circle* entity_circles() {
+    for (int i = 0; i < entities.n; ++i) entity_circle[i] = {position[i], shape[i].radius};
+    return entity_circle;
+}
+
+Entity add_player() {
+    Entity e = new_entity();
+    int id = entity_index(&entities, e);
     position[id] = {10, 10};
     velocity[id] = {0, 0};
     shape[id] = {.type = CIRCLE, .radius = 1, .color = rgba_from_hex(0x264653)};
-    return id;
+    return e;
 }
 
-int add_tree(Vec2 p) {
-    int id = new_id();
+Entity add_creature(Vec2 p) {
+    Entity e = new_entity();
+    int id = entity_index(&entities, e);
     position[id] = p;
-    shape[id] = {.type = CIRCLE, .radius = 2, .color = rgba_from_hex(0x7f5539)};
-    return id;
+    shape[id] = {.type = CIRCLE, .radius = 0.8, .color = rgba_from_hex(0x9d0208)};
+    behavior[id] = BEHAVIOR_SEEK_PLAYER;
+    return e;
+}
+
+int scenery_cell(Vec2 p) {
+    int cx = clampi((int)(p.x / scenery_cell_size), 0, scenery_cells_x - 1);
+    int cy = clampi((int)(p.y / scenery_cell_size), 0, scenery_cells_y - 1);
+    return cy * scenery_cells_x + cx;
+}
+
+// Calls f(i) for the scenery in the cells overlapping [min, max], which may be a little outside
+template <typename F>
+void scenery_for_each(Vec2 min, Vec2 max, F f) {
+    int cx0 = clampi((int)floorf(min.x / scenery_cell_size), 0, scenery_cells_x - 1);
+    int cy0 = clampi((int)floorf(min.y / scenery_cell_size), 0, scenery_cells_y - 1);
+    int cx1 = clampi((int)floorf(max.x / scenery_cell_size), 0, scenery_cells_x - 1);
+    int cy1 = clampi((int)floorf(max.y / scenery_cell_size), 0, scenery_cells_y - 1);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        // A row of cells is contiguous
+        int end = scenery.offset[cy * scenery_cells_x + cx1 + 1];
+        for (int i = scenery.offset[cy * scenery_cells_x + cx0]; i < end; ++i) f(i);
+    }
+}
+
+float scenery_random(uint32_t* counter) {
+    return (noise_hash(scenery_seed, (*counter)++, 0) >> 8) * (1.f / (1 << 24));
+}
+
+// Bridson's Poisson-disk sampling: candidates are drawn in the annulus [r, 2r] around active
+// points and accepted if no point is closer than r, checked on a grid of cells r / sqrt(2) wide
+// that holds at most one point each.
+int poisson_disk(float r, int max_points, Vec2* points) {
+    const int attempts = 20;
+    float cell = r / sqrtf(2);
+    int gw = (int)ceilf(world_x / cell);
+    int gh = (int)ceilf(world_y / cell);
+    int* grid = (int*)malloc(gw * gh * sizeof(int));
+    for (int i = 0; i < gw * gh; ++i) grid[i] = -1;
+    int* active = (int*)malloc(max_points * sizeof(int));
+    int n_active = 0;
+    int n = 0;
+    uint32_t counter = 0;
+
+    auto add = [&](Vec2 p) {
+        grid[(int)(p.y / cell) * gw + (int)(p.x / cell)] = n;
+        active[n_active++] = n;
+        points[n++] = p;
+    };
+    add({scenery_random(&counter) * world_x, scenery_random(&counter) * world_y});
+
+    while (n_active > 0 && n < max_points) {
+        int a = (int)(scenery_random(&counter) * n_active);
+        Vec2 center = points[active[a]];
+        bool found = false;
+        for (int k = 0; k < attempts && !found; ++k) {
+            // Uniform in the square around the annulus, rejected outside it
+            Vec2 offset = {(4 * scenery_random(&counter) - 2) * r, (4 * scenery_random(&counter) - 2) * r};
+            float d2 = vec2_dot(offset, offset);
+            if (d2 < r * r || d2 > 4 * r * r) continue;
+            Vec2 p = center + offset;
+            if (p.x < 0 || p.y < 0 || p.x >= world_x || p.y >= world_y) continue;
+
+            int gx = (int)(p.x / cell);
+            int gy = (int)(p.y / cell);
+            bool far = true;
+            for (int y = std::max(gy - 2, 0); y <= std::min(gy + 2, gh - 1) && far; ++y)
+                for (int x = std::max(gx - 2, 0); x <= std::min(gx + 2, gw - 1) && far; ++x) {
+                    int other = grid[y * gw + x];
+                    if (other < 0) continue;
+                    Vec2 d = points[other] - p;
+                    if (vec2_dot(d, d) < r * r) far = false;
+                }
+            if (far) {
+                add(p);
+                found = true;
+            }
+        }
+        if (!found) active[a] = active[--n_active];
+    }
+
+    free(grid);
+    free(active);
+    return n;
+}
+
+// Empty scenery, nothing baked yet
+void scenery_alloc(Scenery* scenery) {
+    scenery->n = 0;
+    scenery->position = NULL;
+    scenery->shape = NULL;
+    scenery->offset = (int*)calloc(scenery_cells_x * scenery_cells_y + 1, sizeof(int));
+    scenery->shadow = (bool*)world_calloc(world_size, sizeof(bool));
+    scenery->shadow_angle = (float*)malloc(light_cache_tiles_x * light_cache_tiles_y * sizeof(float));
+    for (int t = 0; t < light_cache_tiles_x * light_cache_tiles_y; ++t) scenery->shadow_angle[t] = NAN;
+}
+
+void scenery_free(Scenery* scenery) {
+    free(scenery->position);
+    free(scenery->shape);
+    free(scenery->offset);
+    free(scenery->shadow);
+    free(scenery->shadow_angle);
+}
+
+// Scatters trees over the world, deterministic so snapshots don't need to store them
+void scenery_generate(Scenery* scenery) {
+    // Sampling stops at the cap, one point per r^2 is well above the density it reaches
+    int max_scenery = (int)(world_x * (float)world_y / (scenery_min_distance * scenery_min_distance));
+    Vec2* points = (Vec2*)malloc(max_scenery * sizeof(Vec2));
+    int n_points = poisson_disk(scenery_min_distance, max_scenery, points);
+
+    // Counting sort by cell, dropping the clearing around the player's start
+    Vec2 start = {10, 10};
+    scenery_alloc(scenery);
+    int* count = (int*)calloc(scenery_cells_x * scenery_cells_y + 1, sizeof(int));
+    for (int i = 0; i < n_points; ++i) {
+        if (vec2_norm(points[i] - start) < scenery_clearing) continue;
+        count[scenery_cell(points[i]) + 1]++;
+    }
+    for (int c = 0; c < scenery_cells_x * scenery_cells_y; ++c) count[c + 1] += count[c];
+    memcpy(scenery->offset, count, (scenery_cells_x * scenery_cells_y + 1) * sizeof(int));
+
+    scenery->n = scenery->offset[scenery_cells_x * scenery_cells_y];
+    scenery->position = (Vec2*)malloc(scenery->n * sizeof(Vec2));
+    scenery->shape = (Shape*)malloc(scenery->n * sizeof(Shape));
+    const RGBA colors[] = {rgba_from_hex(0x7f5539), rgba_from_hex(0x2d6a4f), rgba_from_hex(0x40916c)};
+    uint32_t counter = 1 << 30;
+    for (int i = 0; i < n_points; ++i) {
+        if (vec2_norm(points[i] - start) < scenery_clearing) continue;
+        int j = count[scenery_cell(points[i])]++;
+        scenery->position[j] = points[i];
+        float radius = 0.8f + (scenery_max_radius - 0.8f) * scenery_random(&counter);
+        scenery->shape[j] = {.type = CIRCLE, .radius = radius, .color = colors[(int)(3 * scenery_random(&counter))]};
+    }
+    free(count);
+    free(points);
+    printf("scenery: %d trees\n", scenery->n);
+}
+
+// Scenery blocking indirect light, like the entity coverage in indirect_update
+void indirect_add_scenery() {
+    for (int i = 0; i < indirect_x * indirect_y; ++i) indirect.static_transmit[i] = 1;
+    for (int i = 0; i < scenery.n; ++i) {
+        int cx = (int)(scenery.position[i].x / indirect_cell_size);
+        int cy = (int)(scenery.position[i].y / indirect_cell_size);
+        float r = scenery.shape[i].radius;
+        float* t = &indirect.static_transmit[cy * indirect_x + cx];
+        *t = fmaxf(*t - M_PI * r * r / (indirect_cell_size * indirect_cell_size), 0);
+    }
+}
+
+// Pushes a dynamic entity out of the scenery it overlaps, scenery never moves
+void resolve_scenery_collisions(int e) {
+    float reach = shape[e].radius + scenery_max_radius;
+    scenery_for_each(position[e] - Vec2{reach, reach}, position[e] + Vec2{reach, reach}, [&](int i) {
+        Vec2 away = position[e] - scenery.position[i];
+        float distance = vec2_norm(away);
+        float min_distance = shape[e].radius + scenery.shape[i].radius;
+        if (distance < min_distance && distance > 0) {
+            position[e] = scenery.position[i] + away * (min_distance / distance);
+        }
+    });
+}
+
+Entity light_add(Light light) {
+    Entity e = entity_create(&light_slots);
+    if (light_slots.capacity > lights_capacity) {
+        lights_capacity = light_slots.capacity;
+        lights = (Light*)realloc(lights, lights_capacity * sizeof(Light));
+        light_circle = (Circle*)realloc(light_circle, lights_capacity * sizeof(Circle));
+    }
+    lights[light_slots.n - 1] = light;
+    return e;
+}
+
+void light_remove(Entity e) {
+    int id = entity_destroy(&light_slots, e);
+    if (id >= 0) lights[id] = lights[light_slots.n];
+}
+
+Entity add_campfire(Vec2 p) {
+    return light_add({
+        .type = POINT_LIGHT,
+        .position = p,
+        .height = 2,
+        .radius = 20,
+        .color = {1.6, 0.8, 0.3},
+    });
+}
+
+Entity add_lamp(Vec2 p, Vec2 direction) {
+    return light_add({
+        .type = SPOT_LIGHT,
+        .position = p,
+        .height = 4,
+        .radius = 30,
+        .color = {1.2, 1.2, 1.0},
+        .direction = normalize(direction),
+        .cos_inner = 0.9,
+        .cos_outer = 0.7,
+    });
 }
 
 RGBA texture_sample(Image* t, Vec2 p) {
@@ -213,60 +886,500 @@ RGBA texture_sample(Image* t, Vec2 p) {
     return t->data[y * t->w + x];
 }
 
-void make_ground() {
-    int n = n_ground_sample;
+int ground_bucket(Vec2 p) {
+    int bx = clampi((int)p.x / ground_bucket_size, 0, ground_buckets_x - 1);
+    int by = clampi((int)p.y / ground_bucket_size, 0, ground_buckets_y - 1);
+    return by * ground_buckets_x + bx;
+}
 
-    float *weights = (float*)malloc(n * sizeof(float));
+void ground_index_build() {
+    const int n_buckets = ground_buckets_x * ground_buckets_y;
+    int* count = (int*)calloc(n_buckets + 1, sizeof(int));
+    for (int i = 0; i < n_ground_sample; ++i) count[ground_bucket(ground_sample[i].p)]++;
 
-    float max_distance = sqrt(world_x * world_y);
-    for (int y = 0; y < world_y; ++y)
-        for (int x = 0; x < world_x; ++x) {
-            int world_xy = y * world_x + x;
+    ground_index.offset[0] = 0;
+    for (int b = 0; b < n_buckets; ++b) ground_index.offset[b + 1] = ground_index.offset[b] + count[b];
+
+    for (int b = 0; b < n_buckets; ++b) count[b] = ground_index.offset[b];
+    for (int i = 0; i < n_ground_sample; ++i) ground_index.samples[count[ground_bucket(ground_sample[i].p)]++] = i;
+    free(count);
+}
+
+void ground_neighbours_insert(GroundNeighbours* nb, int sample, float distance) {
+    if (nb->n == ground_k_nearest && distance >= nb->distance[nb->n - 1]) return;
+
+    int i = nb->n < ground_k_nearest ? nb->n++ : nb->n - 1;
+    while (i > 0 && nb->distance[i - 1] > distance) {
+        nb->distance[i] = nb->distance[i - 1];
+        nb->sample[i] = nb->sample[i - 1];
+        i--;
+    }
+    nb->distance[i] = distance;
+    nb->sample[i] = sample;
+}
+
+// k nearest samples to p, searching rings of buckets outwards. Samples in ring r + 1 are at least
+// r - 1 bucket sizes away, so the search stops once the k-th distance is below that.
+GroundNeighbours ground_nearest(Vec2 p, int exclude) {
+    GroundNeighbours nb;
+    int bx = clampi((int)p.x / ground_bucket_size, 0, ground_buckets_x - 1);
+    int by = clampi((int)p.y / ground_bucket_size, 0, ground_buckets_y - 1);
+    int max_ring = std::max(ground_buckets_x, ground_buckets_y);
+
+    for (int r = 0; r < max_ring; ++r) {
+        if (nb.n == ground_k_nearest && nb.distance[nb.n - 1] <= (r - 1) * ground_bucket_size) break;
+
+        for (int y = by - r; y <= by + r; ++y) {
+            if (y < 0 || y >= ground_buckets_y) continue;
+            // Only the border of the ring, the inside was visited already
+            int step = (y == by - r || y == by + r) ? 1 : 2 * r;
+            for (int x = bx - r; x <= bx + r; x += std::max(step, 1)) {
+                if (x < 0 || x >= ground_buckets_x) continue;
+
+                int b = y * ground_buckets_x + x;
+                for (int j = ground_index.offset[b]; j < ground_index.offset[b + 1]; ++j) {
+                    int i = ground_index.samples[j];
+                    if (i == exclude) continue;
+                    ground_neighbours_insert(&nb, i, vec2_norm(p - ground_sample[i].p));
+                }
+            }
+        }
+    }
+
+    return nb;
+}
+
+// Samples within `radius` of p, from the buckets overlapping the circle
+int ground_within(Vec2 p, float radius, int* out) {
+    int bx0 = clampi((int)floorf((p.x - radius) / ground_bucket_size), 0, ground_buckets_x - 1);
+    int by0 = clampi((int)floorf((p.y - radius) / ground_bucket_size), 0, ground_buckets_y - 1);
+    int bx1 = clampi((int)floorf((p.x + radius) / ground_bucket_size), 0, ground_buckets_x - 1);
+    int by1 = clampi((int)floorf((p.y + radius) / ground_bucket_size), 0, ground_buckets_y - 1);
+
+    int n = 0;
+    for (int by = by0; by <= by1; ++by)
+        for (int bx = bx0; bx <= bx1; ++bx) {
+            int b = by * ground_buckets_x + bx;
+            for (int j = ground_index.offset[b]; j < ground_index.offset[b + 1]; ++j) {
+                int i = ground_index.samples[j];
+                if (vec2_norm(p - ground_sample[i].p) <= radius) out[n++] = i;
+            }
+        }
+    return n;
+}
+
+GroundType ground_generate_cell(int x, int y, int* candidates, int n_candidates) {
+    Vec2 p = {(float)x, (float)y};
+    GroundNeighbours nb;
+    for (int i = 0; i < n_candidates; ++i) {
+        ground_neighbours_insert(&nb, candidates[i], vec2_norm(p - ground_sample[candidates[i]].p));
+    }
+    if (nb.n == 0) return NONE;
+    if (nb.distance[0] == 0) return ground_sample[nb.sample[0]].type;
+
+    // Weights relative to the nearest sample, same ratios as 1/d^8 without overflowing
+    float cumulative[ground_k_nearest];
+    float total_weight = 0;
+    for (int i = 0; i < nb.n; ++i) {
+        float w = nb.distance[0] / nb.distance[i];
+        w *= w;
+        w *= w;
+        w *= w;
+        total_weight += w;
+        cumulative[i] = total_weight;
+    }
+
+    // Random pick hashed from the cell, so regenerating a region gives the same result
+    float r = (noise_hash(ground_seed, x, y) >> 8) * (1.f / (1 << 24)) * total_weight;
+    int lo = 0;
+    int hi = nb.n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r < cumulative[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return ground_sample[nb.sample[lo]].type;
+}
+
+// Material of a cell, NONE outside the world
+GroundType ground_at(int x, int y) {
+    if (x < 0 || y < 0 || x >= world_x || y >= world_y) return NONE;
+    return (GroundType)chunk_grid_get(&ground.mat, x, y);
+}
+
+// Works tile by tile: the k nearest samples of any cell in a tile are within d_k(center) plus the
+// tile diagonal of its center, so each cell only compares against that short candidate list.
+void make_ground(int x0, int y0, int x1, int y1, ChunkGrid* mat) {
+    int candidates[max_ground_sample];
+    uint8_t cells[ground_tile_size * ground_tile_size];
+    const float diagonal = ground_tile_size * 1.4143f;
+
+    for (int ty = y0; ty < y1; ty += ground_tile_size)
+        for (int tx = x0; tx < x1; tx += ground_tile_size) {
+            int tx1 = std::min(tx + ground_tile_size, x1);
+            int ty1 = std::min(ty + ground_tile_size, y1);
+            Vec2 center = {(tx + tx1 - 1) / 2.f, (ty + ty1 - 1) / 2.f};
+
+            GroundNeighbours nb = ground_nearest(center, -1);
+            float radius = nb.n < ground_k_nearest ? 2.f * (world_x + world_y) : nb.distance[nb.n - 1] + diagonal;
+            int n_candidates = ground_within(center, radius, candidates);
+
+            for (int y = ty; y < ty1; ++y)
+                for (int x = tx; x < tx1; ++x) {
+                    cells[(y - ty) * ground_tile_size + (x - tx)] = ground_generate_cell(x, y, candidates, n_candidates);
+                }
+            chunk_grid_write(mat, tx, ty, tx1, ty1, cells, ground_tile_size);
+        }
+}
+
+void light_cache_invalidate(int x0, int y0, int x1, int y1) {
+    int tx0 = clampi(x0 / light_cache_tile_size, 0, light_cache_tiles_x - 1);
+    int ty0 = clampi(y0 / light_cache_tile_size, 0, light_cache_tiles_y - 1);
+    int tx1 = clampi((x1 - 1) / light_cache_tile_size, 0, light_cache_tiles_x - 1);
+    int ty1 = clampi((y1 - 1) / light_cache_tile_size, 0, light_cache_tiles_y - 1);
+    for (int ty = ty0; ty <= ty1; ++ty)
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            light_cache.valid[ty * light_cache_tiles_x + tx] = false;
+        }
+}
 
-            Vec2 p = {(float)x, (float)y};
+void light_cache_invalidate_all() {
+    for (int i = 0; i < light_cache_tiles_x * light_cache_tiles_y; ++i) light_cache.valid[i] = false;
+}
 
-            bool exact_match = false;
-            float total_weight = 0;
-            for (int i = 0; i < n; ++i) {
-                GroundSample g = ground_sample[i];
-                float distance = vec2_norm(p - g.p);
+void light_cache_invalidate_shadow(Circle c, Vec3 sun_vec) {
+    ShadowBounds b = shadow_bounds(c, sun_vec, shadow_max_length);
+    light_cache_invalidate(floorf(b.min.x), floorf(b.min.y), ceilf(b.max.x) + 1, ceilf(b.max.y) + 1);
+}
 
-                if (distance == 0) {
-                    ground.mat[y * world_x + x] = g.type;
-                    exact_match = true;
-                    break;
+// Rebuilds the mips above the world texels [x0, x1) x [y0, y1), level by level
+void ground_mips_update(uint32_t** levels, bool normals, int x0, int y0, int x1, int y1) {
+    for (int l = 1; l < ground_mip_levels; ++l) {
+        uint32_t* src = levels[l - 1];
+        uint32_t* dst = levels[l];
+        int src_w = ground_mips.w[l - 1];
+        int src_h = ground_mips.h[l - 1];
+        for (int y = y0 >> l; y <= (y1 - 1) >> l; ++y) {
+            for (int x = x0 >> l; x <= (x1 - 1) >> l; ++x) {
+                int sx0 = 2 * x, sx1 = std::min(2 * x + 1, src_w - 1);
+                int sy0 = 2 * y, sy1 = std::min(2 * y + 1, src_h - 1);
+                uint32_t a = src[sy0 * src_w + sx0], b = src[sy0 * src_w + sx1];
+                uint32_t c = src[sy1 * src_w + sx0], d = src[sy1 * src_w + sx1];
+                if (normals) {
+                    Vec3 n = vec3_add(vec3_add(normal_decode(a), normal_decode(b)),
+                                      vec3_add(normal_decode(c), normal_decode(d)));
+                    float length = vec3_norm(n);
+                    dst[y * ground_mips.w[l] + x] = normal_encode(length > 0 ? vec3_div(n, length) : Vec3{0, 0, 1});
                 } else {
-                    weights[i] = total_weight;
-                    float w =  1.f / powf(distance / max_distance, 8);
-                    total_weight += w;
+                    Vec3 sum = vec3_add(vec3_add(albedo_decode(a), albedo_decode(b)),
+                                        vec3_add(albedo_decode(c), albedo_decode(d)));
+                    dst[y * ground_mips.w[l] + x] = albedo_encode(vec3_scale(sum, 0.25f));
                 }
             }
+        }
+    }
+}
 
-            if (exact_match) continue;
+// Allocates the levels above 0, except the G-buffer ones a snapshot load has already mapped
+void ground_mips_init() {
+    ground_mips.albedo[0] = rendering.albedo;
+    ground_mips.normal[0] = rendering.normal;
+    ground_mips.lit[0] = light_cache.color;
+    for (int l = 0; l < ground_mip_levels; ++l) {
+        ground_mips.w[l] = (world_x + (1 << l) - 1) >> l;
+        ground_mips.h[l] = (world_y + (1 << l) - 1) >> l;
+        if (l == 0) continue;
+        int size = ground_mips.w[l] * ground_mips.h[l];
+        if (!ground_mips.albedo[l]) ground_mips.albedo[l] = (uint32_t*)world_calloc(size, sizeof(uint32_t));
+        if (!ground_mips.normal[l]) ground_mips.normal[l] = (uint32_t*)world_calloc(size, sizeof(uint32_t));
+        ground_mips.lit[l] = (uint32_t*)world_calloc(size, sizeof(uint32_t));
+    }
+}
 
-            float r = randf() * total_weight;
-            int chosen_sample = n-1;
-            for (int i = 1; i < n; ++i) {
-                if (r < weights[i]) chosen_sample = i-1;
+void draw_material(int x0, int y0, int x1, int y1, const ChunkGrid* mat, uint32_t* normal, uint32_t* albedo) {
+    for (int y = y0; y < y1; ++y)
+        for (int run = x0; run < x1;) {
+            // Contiguous up to the end of the chunk row
+            int run_end = chunk_grid_run_end(run, x1);
+            const uint8_t* m = chunk_grid_row(mat, run, y) - run;
+            for (int x = run; x < run_end; ++x) {
+                if (m[x] == NONE) continue;
+
+                int i = y * world_x + x;
+                RGBA color = texture_sample(&texture[m[x]], {(float)x, (float)y});
+                normal[i] = normal_encode({0, 0, 1});
+                albedo[i] = albedo_encode({color.r, color.g, color.b});
             }
+            run = run_end;
+        }
+}
+
+void draw_material_pass(int x0, int y0, int x1, int y1) {
+    light_cache_invalidate(x0, y0, x1, y1);
+    draw_material(x0, y0, x1, y1, &ground.mat, rendering.normal, rendering.albedo);
+    ground_mips_update(ground_mips.albedo, false, x0, y0, x1, y1);
+    ground_mips_update(ground_mips.normal, true, x0, y0, x1, y1);
+}
 
-            ground.mat[world_xy] = ground_sample[chosen_sample].type;
+// Marks the tiles where `sample` is among the k nearest, i.e. cells closer to it than their current
+// k-th nearest sample. That region is star-shaped around the sample so a flood fill over tiles
+// reaches all of it. d_k is 1-Lipschitz, so its value at the tile center plus half the diagonal
+// bounds it over the whole tile.
+int ground_influence_tiles(int sample, bool* tiles) {
+    for (int i = 0; i < ground_tiles_x * ground_tiles_y; ++i) tiles[i] = false;
+
+    Vec2 s = ground_sample[sample].p;
+    int start_x = clampi((int)s.x / ground_tile_size, 0, ground_tiles_x - 1);
+    int start_y = clampi((int)s.y / ground_tile_size, 0, ground_tiles_y - 1);
+    int* queue = (int*)malloc(ground_tiles_x * ground_tiles_y * sizeof(int));
+    bool* visited = (bool*)calloc(ground_tiles_x * ground_tiles_y, sizeof(bool));
+    int head = 0;
+    int tail = 0;
+    int n_tiles = 0;
+    queue[tail++] = start_y * ground_tiles_x + start_x;
+    visited[queue[0]] = true;
+
+    const float half_diagonal = ground_tile_size * 0.7072f;
+    while (head < tail) {
+        int t = queue[head++];
+        int tx = t % ground_tiles_x;
+        int ty = t / ground_tiles_x;
+        float x0 = tx * ground_tile_size;
+        float y0 = ty * ground_tile_size;
+        float x1 = fminf(x0 + ground_tile_size, world_x) - 1;
+        float y1 = fminf(y0 + ground_tile_size, world_y) - 1;
+        Vec2 center = {(x0 + x1) / 2, (y0 + y1) / 2};
+        Vec2 closest = {clampf(s.x, x0, x1), clampf(s.y, y0, y1)};
+
+        GroundNeighbours nb = ground_nearest(center, sample);
+        bool affected = nb.n < ground_k_nearest ||
+                        vec2_norm(closest - s) < nb.distance[nb.n - 1] + half_diagonal;
+        if (!affected) continue;
+
+        tiles[t] = true;
+        n_tiles++;
+
+        int neighbours[4][2] = {{tx - 1, ty}, {tx + 1, ty}, {tx, ty - 1}, {tx, ty + 1}};
+        for (int i = 0; i < 4; ++i) {
+            int nx = neighbours[i][0];
+            int ny = neighbours[i][1];
+            if (nx < 0 || ny < 0 || nx >= ground_tiles_x || ny >= ground_tiles_y) continue;
+            int n = ny * ground_tiles_x + nx;
+            if (visited[n]) continue;
+            visited[n] = true;
+            queue[tail++] = n;
         }
+    }
 
-    free(weights);
+    free(queue);
+    free(visited);
+    return n_tiles;
 }
 
-void draw_material_pass() {
-    for (int i = 0; i < world_size; ++i) {
-        GroundType mat = ground.mat[i];
+// Blocks the cells of [x0, x1) x [y0, y1) whose center the player can't stand on next to a tree
+void path_mark_scenery(uint8_t* cells, Vec2 p, float radius, int x0, int y0, int x1, int y1) {
+    radius += path_agent_radius;
+    int cx0 = std::max(x0, (int)floorf(p.x - radius));
+    int cy0 = std::max(y0, (int)floorf(p.y - radius));
+    int cx1 = std::min(x1, (int)ceilf(p.x + radius));
+    int cy1 = std::min(y1, (int)ceilf(p.y + radius));
+    for (int y = cy0; y < cy1; ++y)
+        for (int x = cx0; x < cx1; ++x) {
+            Vec2 d = Vec2{x + 0.5f, y + 0.5f} - p;
+            if (vec2_dot(d, d) < radius * radius) cells[y * world_x + x] = path_scenery;
+        }
+}
 
-        if (mat != DIRT && mat != GRASS) continue;
+// Cells whose center is under a tree block sight
+void sight_mark_scenery() {
+    memset(sight_trees, 0, world_size);
+    for (int i = 0; i < scenery.n; ++i) {
+        Vec2 p = scenery.position[i];
+        float r = scenery.shape[i].radius;
+        for (int y = std::max(0, (int)floorf(p.y - r)); y < std::min(world_y, (int)ceilf(p.y + r)); ++y)
+            for (int x = std::max(0, (int)floorf(p.x - r)); x < std::min(world_x, (int)ceilf(p.x + r)); ++x) {
+                Vec2 d = Vec2{x + 0.5f, y + 0.5f} - p;
+                if (vec2_dot(d, d) < r * r) sight_trees[y * world_x + x] = 1;
+            }
+    }
+    fov_invalidate(&sight);
+}
+
+void ground_generation_worker() {
+    GroundGeneration* g = &ground_generation;
+    scenery_generate(g->scenery);
+    // The main thread takes the struct over, the arrays stay where they are
+    int n_trees = g->scenery->n;
+    Vec2* tree_position = g->scenery->position;
+    Shape* tree_shape = g->scenery->shape;
+    g->scenery_ready.store(true, std::memory_order_release);
+    while (!g->stop) {
+        int fx = g->focus_x, fy = g->focus_y;
+        int best = -1;
+        int best_distance = 0;
+        for (int t = 0; t < generation_tiles; ++t) {
+            if (g->state[t].load(std::memory_order_relaxed) != TILE_PENDING) continue;
+            int dx = t % generation_tiles_x - fx;
+            int dy = t / generation_tiles_x - fy;
+            if (best < 0 || dx * dx + dy * dy < best_distance) {
+                best = t;
+                best_distance = dx * dx + dy * dy;
+            }
+        }
+        if (best < 0) break;
+
+        int x0 = (best % generation_tiles_x) * generation_tile_size;
+        int y0 = (best / generation_tiles_x) * generation_tile_size;
+        int x1 = std::min(x0 + generation_tile_size, world_x);
+        int y1 = std::min(y0 + generation_tile_size, world_y);
+        make_ground(x0, y0, x1, y1, &g->mat);
+        draw_material(x0, y0, x1, y1, &g->mat, g->normal, g->albedo);
+        g->state[best].store(TILE_GENERATED, std::memory_order_release);
+    }
+    if (g->stop) return;
 
-        int x = i % world_x;
-        int y = i / world_x;
-        RGBA color = texture_sample(&texture[mat], {(float)x, (float)y});
-        rendering.normal[i] = {0, 0, 1};
-        rendering.albedo[i] = {color.r, color.g, color.b};
+    // Staging holds the same materials the main thread copies in, a loaded ground is read as is
+    uint8_t* cells = (uint8_t*)world_calloc(world_size, 1);
+    chunk_grid_read(g->mat.cells ? &g->mat : &ground.mat, 0, 0, world_x, world_y, cells, world_x);
+    for (int i = 0; i < n_trees; ++i) {
+        path_mark_scenery(cells, tree_position[i], tree_shape[i].radius, 0, 0, world_x, world_y);
+    }
+    hpa_build(&g->paths, {world_x, world_y, cells, (1 << WATER) | (1 << path_scenery)});
+    g->paths_ready.store(true, std::memory_order_release);
+}
+
+GroundGeneration::~GroundGeneration() {
+    stop = true;
+    if (worker.joinable()) worker.join();
+}
+
+// Starts scattering the scenery and, for a new world, fills it with a checker placeholder and
+// starts generating the real ground
+void ground_generation_start(bool generate_ground) {
+    GroundGeneration* g = &ground_generation;
+    g->scenery = (Scenery*)malloc(sizeof(Scenery));
+    g->scenery_ready = false;
+    g->paths_ready = false;
+    g->stop = false;
+    g->running = true;
+    g->start = std::chrono::high_resolution_clock::now();
+    if (!generate_ground) {
+        for (int t = 0; t < generation_tiles; ++t) g->state[t] = TILE_DONE;
+        g->n_done = generation_tiles;
+        g->mat = {};
+        g->normal = NULL;
+        g->albedo = NULL;
+        g->worker = std::thread(ground_generation_worker);
+        return;
+    }
+
+    for (int y = 0; y < world_y; ++y)
+        for (int x = 0; x < world_x; ++x) {
+            int i = y * world_x + x;
+            float shade = ((x / 8 + y / 8) % 2) ? 0.35f : 0.3f;
+            rendering.normal[i] = normal_encode({0, 0, 1});
+            rendering.albedo[i] = albedo_encode({shade, shade, shade});
+        }
+    ground_mips_update(ground_mips.albedo, false, 0, 0, world_x, world_y);
+    ground_mips_update(ground_mips.normal, true, 0, 0, world_x, world_y);
+
+    g->mat = chunk_grid_create(world_x, world_y, NONE);
+    g->normal = (uint32_t*)world_calloc(world_size, sizeof(uint32_t));
+    g->albedo = (uint32_t*)world_calloc(world_size, sizeof(uint32_t));
+    for (int t = 0; t < generation_tiles; ++t) g->state[t] = TILE_PENDING;
+    g->n_done = 0;
+    g->worker = std::thread(ground_generation_worker);
+}
+
+// Steps the region again, after cells changed from outside the automaton
+void ground_dynamics_wake(int x0, int y0, int x1, int y1) {
+    if (!ground_dynamics.running) return;
+    // Cells next to the region read it too
+    int cx0 = std::max(0, (x0 - 1) / dynamics_chunk_size);
+    int cy0 = std::max(0, (y0 - 1) / dynamics_chunk_size);
+    int cx1 = std::min(dynamics_chunks_x - 1, x1 / dynamics_chunk_size);
+    int cy1 = std::min(dynamics_chunks_y - 1, y1 / dynamics_chunk_size);
+    for (int cy = cy0; cy <= cy1; ++cy)
+        for (int cx = cx0; cx <= cx1; ++cx) ground_dynamics.chunks[cy * dynamics_chunks_x + cx].active = true;
+}
+
+void ground_dynamics_start() {
+    GroundDynamics* d = &ground_dynamics;
+    if (!d->moisture.cells) d->moisture = chunk_grid_create(world_x, world_y, 0);
+    d->running = true;
+    d->accumulated = 0;
+
+    // Without water or damp ground nothing can change, as in a new world
+    for (int c = 0; c < d->moisture.chunks_x * d->moisture.chunks_y; ++c) {
+        if (!d->moisture.cells[c] && !d->moisture.uniform[c]) continue;
+        int x0 = (c % d->moisture.chunks_x) * chunk_size;
+        int y0 = (c / d->moisture.chunks_x) * chunk_size;
+        int x1 = std::min(x0 + chunk_size, world_x);
+        int y1 = std::min(y0 + chunk_size, world_y);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x) {
+                if (chunk_grid_get(&d->moisture, x, y)) ground_dynamics_wake(x, y, x + 1, y + 1);
+            }
+    }
+}
+
+// Copies the tiles the worker finished into the live buffers, and points it at the camera
+void ground_generation_poll() {
+    GroundGeneration* g = &ground_generation;
+    if (!g->running) return;
+
+    g->focus_x = clampi((int)((camera.position.x + camera.size_x / 2) / generation_tile_size), 0, generation_tiles_x - 1);
+    g->focus_y = clampi((int)((camera.position.y + camera.size_y / 2) / generation_tile_size), 0, generation_tiles_y - 1);
+
+    if (g->scenery && g->scenery_ready.load(std::memory_order_acquire)) {
+        scenery_free(&scenery);
+        scenery = *g->scenery;
+        free(g->scenery);
+        g->scenery = NULL;
+        indirect_add_scenery();
+        light_cache_invalidate_all();
+        sight_mark_scenery();
+    }
+
+    for (int t = 0; t < generation_tiles; ++t) {
+        if (g->state[t].load(std::memory_order_acquire) != TILE_GENERATED) continue;
+
+        int x0 = (t % generation_tiles_x) * generation_tile_size;
+        int y0 = (t / generation_tiles_x) * generation_tile_size;
+        int x1 = std::min(x0 + generation_tile_size, world_x);
+        int y1 = std::min(y0 + generation_tile_size, world_y);
+        chunk_grid_copy_chunk(&ground.mat, &g->mat, t);
+        for (int y = y0; y < y1; ++y) {
+            int i = y * world_x + x0;
+            memcpy(rendering.normal + i, g->normal + i, (x1 - x0) * sizeof(uint32_t));
+            memcpy(rendering.albedo + i, g->albedo + i, (x1 - x0) * sizeof(uint32_t));
+        }
+        light_cache_invalidate(x0, y0, x1, y1);
+        ground_mips_update(ground_mips.albedo, false, x0, y0, x1, y1);
+        ground_mips_update(ground_mips.normal, true, x0, y0, x1, y1);
+        g->state[t] = TILE_DONE;
+        g->n_done++;
+    }
+
+    if (g->n_done == generation_tiles && !g->scenery && g->paths_ready.load(std::memory_order_acquire)) {
+        g->worker.join();
+        g->running = false;
+        hpa_destroy(&ground_paths);
+        free(path_cells);
+        ground_paths = g->paths;
+        path_cells = (uint8_t*)ground_paths.grid.cells;
+        g->paths = {};
+        flow_field_worker_start(&creature_flow, ground_paths.grid, creature_flow_radius);
+        ground_dynamics_start();
+        chunk_grid_destroy(&g->mat);
+        free(g->normal);
+        free(g->albedo);
+        auto end = std::chrono::high_resolution_clock::now();
+        printf("world: generated in %.2fs\n", std::chrono::duration<float>(end - g->start).count());
     }
 }
 
@@ -275,25 +1388,460 @@ void make_default_ground() {
     ground_sample[n_ground_sample++] = {.type = GRASS, .p = {40, 60}};
     ground_sample[n_ground_sample++] = {.type = GRASS, .p = {30, 70}};
     ground_sample[n_ground_sample++] = {.type = DIRT, .p = {180, 180}};
-    make_ground();
-    draw_material_pass();
+    ground_index_build();
+    ground_generation_start(true);
+}
+
+// Next state of chunk `active[task]` into its own buffers
+void ground_dynamics_step_chunk(int task, void* data) {
+    GroundDynamics* d = &ground_dynamics;
+    int c = d->active[task];
+    DynamicsChunk* chunk = &d->chunks[c];
+    int x0 = (c % dynamics_chunks_x) * dynamics_chunk_size;
+    int y0 = (c / dynamics_chunks_x) * dynamics_chunk_size;
+    int x1 = std::min(x0 + dynamics_chunk_size, world_x);
+    int y1 = std::min(y0 + dynamics_chunk_size, world_y);
+    // The chunk and a one cell border, read a chunk row at a time. Outside the world is NONE and
+    // dry, which neighbours nothing: neither grass nor land nor wetter.
+    const int stride = dynamics_chunk_size + 2;
+    uint8_t mat[stride * stride];
+    uint8_t moisture[stride * stride];
+    memset(mat, NONE, sizeof(mat));
+    memset(moisture, 0, sizeof(moisture));
+    int bx0 = std::max(x0 - 1, 0);
+    int by0 = std::max(y0 - 1, 0);
+    int bx1 = std::min(x1 + 1, world_x);
+    int by1 = std::min(y1 + 1, world_y);
+    int border = (by0 - (y0 - 1)) * stride + (bx0 - (x0 - 1));
+    chunk_grid_read(&ground.mat, bx0, by0, bx1, by1, mat + border, stride);
+    chunk_grid_read(&d->moisture, bx0, by0, bx1, by1, moisture + border, stride);
+
+    chunk->mat_changed = false;
+    chunk->water_changed = false;
+    chunk->busy = false;
+    chunk->wake = 0;
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            int i = (y - y0 + 1) * stride + (x - x0 + 1);
+            int local = (y - y0) * dynamics_chunk_size + (x - x0);
+            GroundType m = (GroundType)mat[i];
+            uint8_t wet = moisture[i];
+
+            int neighbours[4] = {i - 1, i + 1, i - stride, i + stride};
+            int wettest = 0;
+            bool next_to_grass = false;
+            bool next_to_land = false;
+            for (int k = 0; k < 4; ++k) {
+                GroundType neighbour = (GroundType)mat[neighbours[k]];
+                wettest = std::max(wettest, (int)moisture[neighbours[k]]);
+                next_to_grass |= neighbour == GRASS;
+                next_to_land |= neighbour != WATER && neighbour != NONE;
+            }
+
+            uint32_t roll = noise_hash(dynamics_seed + d->step, x, y);
+            GroundType next = m;
+            uint8_t next_wet = wet;
+            bool can_change = false;
+            if (m == WATER) {
+                // Pools shrink from their edge
+                next_wet = 255;
+                can_change = next_to_land;
+                if (next_to_land && roll < water_evaporate_chance) next = MUD;
+            } else if (m != NONE) {
+                next_wet = (uint8_t)std::max({0, wettest - moisture_falloff, wet - moisture_drying});
+                can_change = next_wet != wet;
+                if (m == MUD && next_wet < mud_dry) next = DIRT;
+                if ((m == GRASS || m == DIRT) && next_wet >= mud_wet) next = MUD;
+                if (m == DIRT && next == DIRT && next_wet >= grass_moisture && next_to_grass) {
+                    can_change = true;
+                    if (roll < grass_spread_chance) next = GRASS;
+                }
+            }
+
+            chunk->mat[local] = next;
+            chunk->moisture[local] = next_wet;
+            bool changed = next != m || next_wet != wet;
+            chunk->busy |= can_change || changed;
+            chunk->mat_changed |= next != m;
+            chunk->water_changed |= (next == WATER) != (m == WATER);
+            if (changed) {
+                if (x == x0) chunk->wake |= WAKE_LEFT;
+                if (x == x1 - 1) chunk->wake |= WAKE_RIGHT;
+                if (y == y0) chunk->wake |= WAKE_TOP;
+                if (y == y1 - 1) chunk->wake |= WAKE_BOTTOM;
+            }
+        }
+}
+
+// Keeps path_cells in step with water appearing or drying up in the region
+void path_cells_update_water(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            int i = y * world_x + x;
+            if (path_cells[i] != path_scenery) path_cells[i] = chunk_grid_get(&ground.mat, x, y);
+        }
+    hpa_repair(&ground_paths, x0, y0, x1, y1);
+}
+
+void ground_dynamics_update(float dt) {
+    GroundDynamics* d = &ground_dynamics;
+    if (!d->running) return;
+    d->accumulated += dt;
+    if (d->accumulated < dynamics_step_seconds) return;
+    d->accumulated = fminf(d->accumulated - dynamics_step_seconds, dynamics_step_seconds);
+
+    d->n_active = 0;
+    for (int c = 0; c < dynamics_chunks; ++c) {
+        DynamicsChunk* chunk = &d->chunks[c];
+        if (!chunk->active) continue;
+        if (!chunk->mat) {
+            int cells = dynamics_chunk_size * dynamics_chunk_size;
+            chunk->mat = (GroundType*)malloc(cells * sizeof(GroundType));
+            chunk->moisture = (uint8_t*)malloc(cells);
+        }
+        d->active[d->n_active++] = c;
+    }
+    if (d->n_active == 0) return;
+    thread_pool_run(d->n_active, ground_dynamics_step_chunk, NULL);
+    d->step++;
+
+    // Swap the next state in and redraw what changed. The flow worker reads path_cells.
+    bool waited = false;
+    for (int k = 0; k < d->n_active; ++k) {
+        int c = d->active[k];
+        DynamicsChunk* chunk = &d->chunks[c];
+        int cx = c % dynamics_chunks_x;
+        int cy = c / dynamics_chunks_x;
+        int x0 = cx * dynamics_chunk_size;
+        int y0 = cy * dynamics_chunk_size;
+        int x1 = std::min(x0 + dynamics_chunk_size, world_x);
+        int y1 = std::min(y0 + dynamics_chunk_size, world_y);
+        chunk_grid_write(&d->moisture, x0, y0, x1, y1, chunk->moisture, dynamics_chunk_size);
+        if (chunk->mat_changed) chunk_grid_write(&ground.mat, x0, y0, x1, y1, (uint8_t*)chunk->mat, dynamics_chunk_size);
+        if (chunk->mat_changed) draw_material_pass(x0, y0, x1, y1);
+        if (chunk->water_changed) {
+            if (!waited) flow_field_worker_wait(&creature_flow);
+            waited = true;
+            path_cells_update_water(x0, y0, x1, y1);
+        }
+
+        chunk->active = chunk->busy;
+        if ((chunk->wake & WAKE_LEFT) && cx > 0) d->chunks[c - 1].active = true;
+        if ((chunk->wake & WAKE_RIGHT) && cx < dynamics_chunks_x - 1) d->chunks[c + 1].active = true;
+        if ((chunk->wake & WAKE_TOP) && cy > 0) d->chunks[c - dynamics_chunks_x].active = true;
+        if ((chunk->wake & WAKE_BOTTOM) && cy < dynamics_chunks_y - 1) d->chunks[c + dynamics_chunks_x].active = true;
+    }
+    if (waited) flow_field_worker_invalidate(&creature_flow);
+}
+
+// A pool of water at p, left to seep away
+void ground_pour_water(Vec2 p) {
+    if (!ground_dynamics.running) return;
+    const float radius = 4;
+    int x0 = std::max(0, (int)floorf(p.x - radius));
+    int y0 = std::max(0, (int)floorf(p.y - radius));
+    int x1 = std::min(world_x, (int)ceilf(p.x + radius));
+    int y1 = std::min(world_y, (int)ceilf(p.y + radius));
+    if (x1 <= x0 || y1 <= y0) return;
+    Vec2 player = position[entity_index(&entities, controlling)];
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            Vec2 d = Vec2{x + 0.5f, y + 0.5f} - p;
+            int i = y * world_x + x;
+            Vec2 from_player = Vec2{x + 0.5f, y + 0.5f} - player;
+            if (vec2_dot(d, d) >= radius * radius || sight_trees[i] || ground_at(x, y) == NONE) continue;
+            // The player would be stuck
+            if (vec2_dot(from_player, from_player) < 2 * 2) continue;
+            chunk_grid_set(&ground.mat, x, y, WATER);
+            chunk_grid_set(&ground_dynamics.moisture, x, y, 255);
+        }
+    draw_material_pass(x0, y0, x1, y1);
+    flow_field_worker_wait(&creature_flow);
+    path_cells_update_water(x0, y0, x1, y1);
+    flow_field_worker_invalidate(&creature_flow);
+    ground_dynamics_wake(x0, y0, x1, y1);
 }
 
 void ground_add_more(Vec2 p) {
+    // The worker reads the samples
+    if (n_ground_sample >= max_ground_sample || ground_generation.running) return;
+
     int x = (int)p.x;
     int y = (int)p.y;
-    GroundType target = ground.mat[y * world_x + x];
-    ground_sample[n_ground_sample++] = {.type = target, .p = p};
-    make_ground();
-    draw_material_pass();
+    GroundType target = ground_at(x, y);
+    if (target == NONE) return;
+    int sample = n_ground_sample++;
+    ground_sample[sample] = {.type = target, .p = p};
+    ground_index_build();
+
+    bool* tiles = (bool*)malloc(ground_tiles_x * ground_tiles_y * sizeof(bool));
+    int n_tiles = ground_influence_tiles(sample, tiles);
+    int changed_x0 = world_x, changed_y0 = world_y, changed_x1 = 0, changed_y1 = 0;
+    // The flow worker reads path_cells
+    if (path_cells) flow_field_worker_wait(&creature_flow);
+    for (int t = 0; t < ground_tiles_x * ground_tiles_y; ++t) {
+        if (!tiles[t]) continue;
+
+        int x0 = (t % ground_tiles_x) * ground_tile_size;
+        int y0 = (t / ground_tiles_x) * ground_tile_size;
+        int x1 = std::min(x0 + ground_tile_size, world_x);
+        int y1 = std::min(y0 + ground_tile_size, world_y);
+        make_ground(x0, y0, x1, y1, &ground.mat);
+        draw_material_pass(x0, y0, x1, y1);
+        if (path_cells) {
+            chunk_grid_read(&ground.mat, x0, y0, x1, y1, path_cells + y0 * world_x + x0, world_x);
+            float r = scenery_max_radius + path_agent_radius;
+            scenery_for_each(Vec2{x0 - r, y0 - r}, Vec2{x1 + r, y1 + r}, [&](int i) {
+                path_mark_scenery(path_cells, scenery.position[i], scenery.shape[i].radius, x0, y0, x1, y1);
+            });
+        }
+        changed_x0 = std::min(changed_x0, x0);
+        changed_y0 = std::min(changed_y0, y0);
+        changed_x1 = std::max(changed_x1, x1);
+        changed_y1 = std::max(changed_y1, y1);
+    }
+    // The influence of a sample is one patch, its bounds don't cover much more
+    if (path_cells) {
+        hpa_repair(&ground_paths, changed_x0, changed_y0, changed_x1, changed_y1);
+        flow_field_worker_invalidate(&creature_flow);
+    }
+    ground_dynamics_wake(changed_x0, changed_y0, changed_x1, changed_y1);
+    free(tiles);
+}
+
+SnapshotSlots snapshot_save_slots(SnapshotWriter* w, EntitySlots* s) {
+    return {
+        .n = s->n,
+        .capacity = s->capacity,
+        .free_head = s->free_head,
+        .generation = snapshot_append(w, s->generation, s->capacity * sizeof(uint32_t)),
+        .dense = snapshot_append(w, s->dense, s->capacity * sizeof(int)),
+        .slot = snapshot_append(w, s->slot, s->capacity * sizeof(int)),
+        .next_free = snapshot_append(w, s->next_free, s->capacity * sizeof(int)),
+    };
+}
+
+// Malloc'd copy of a snapshot section, for arrays that keep growing after the load
+void* snapshot_copy(MappedFile* f, uint64_t offset, size_t size) {
+    void* p = malloc(size);
+    memcpy(p, f->data + offset, size);
+    return p;
+}
+
+void snapshot_load_slots(MappedFile* f, SnapshotSlots* in, EntitySlots* s) {
+    s->n = in->n;
+    s->capacity = in->capacity;
+    s->free_head = in->free_head;
+    s->generation = (uint32_t*)snapshot_copy(f, in->generation, in->capacity * sizeof(uint32_t));
+    s->dense = (int*)snapshot_copy(f, in->dense, in->capacity * sizeof(int));
+    s->slot = (int*)snapshot_copy(f, in->slot, in->capacity * sizeof(int));
+    s->next_free = (int*)snapshot_copy(f, in->next_free, in->capacity * sizeof(int));
+}
+
+// Uniform chunks are a byte each, the others are appended in chunk order
+SnapshotChunks snapshot_save_chunks(SnapshotWriter* w, const ChunkGrid* g) {
+    int n = g->chunks_x * g->chunks_y;
+    int32_t* index = (int32_t*)malloc(n * sizeof(int32_t));
+    int n_cells = 0;
+    for (int c = 0; c < n; ++c) index[c] = g->cells[c] ? n_cells++ : -1;
+    SnapshotChunks s = {
+        .uniform = snapshot_append(w, g->uniform, n),
+        .index = snapshot_append(w, index, n * sizeof(int32_t)),
+        .cells = 0,
+    };
+    // Chunks are a multiple of the section alignment, so they follow each other without padding
+    for (int c = 0; c < n; ++c) {
+        if (!g->cells[c]) continue;
+        uint64_t offset = snapshot_append(w, g->cells[c], chunk_size * chunk_size);
+        if (index[c] == 0) s.cells = offset;
+    }
+    free(index);
+    return s;
+}
+
+ChunkGrid snapshot_load_chunks(MappedFile* f, SnapshotChunks* in) {
+    ChunkGrid g = chunk_grid_create(world_x, world_y, 0);
+    int n = g.chunks_x * g.chunks_y;
+    memcpy(g.uniform, f->data + in->uniform, n);
+    const int32_t* index = (const int32_t*)(f->data + in->index);
+    for (int c = 0; c < n; ++c) {
+        if (index[c] < 0) continue;
+        chunk_grid_load_chunk(&g, c, (const uint8_t*)f->data + in->cells + (size_t)index[c] * chunk_size * chunk_size);
+    }
+    return g;
+}
+
+bool world_snapshot_save(const char* path) {
+    if (ground_generation.running) {
+        printf("snapshot: ground is still generating\n");
+        return false;
+    }
+
+    SnapshotWriter w;
+    SnapshotHeader h = {
+        .magic = snapshot_magic,
+        .version = snapshot_version,
+        .world_x = world_x,
+        .world_y = world_y,
+        .time_ms = time_ms,
+        .sun_angle = sun.angle,
+        .camera_position = camera.position,
+        .camera_size_x = camera.size_x,
+        .camera_size_y = camera.size_y,
+        .controlling = controlling,
+        .n_ground_sample = n_ground_sample,
+    };
+    snapshot_append(&w, &h, sizeof(h));
+    h.entities = snapshot_save_slots(&w, &entities);
+    h.position = snapshot_append(&w, position, entities.capacity * sizeof(Vec2));
+    h.velocity = snapshot_append(&w, velocity, entities.capacity * sizeof(Vec2));
+    h.shape = snapshot_append(&w, shape, entities.capacity * sizeof(Shape));
+    h.behavior = snapshot_append(&w, behavior, entities.capacity * sizeof(Behavior));
+    h.light_slots = snapshot_save_slots(&w, &light_slots);
+    h.lights = snapshot_append(&w, lights, light_slots.capacity * sizeof(Light));
+    h.ground_sample = snapshot_append(&w, ground_sample, n_ground_sample * sizeof(GroundSample));
+    h.explored = snapshot_append(&w, sight.explored, world_size);
+    h.moisture = snapshot_save_chunks(&w, &ground_dynamics.moisture);
+    h.mat = snapshot_save_chunks(&w, &ground.mat);
+    for (int l = 0; l < ground_mip_levels; ++l) {
+        size_t size = (size_t)ground_mips.w[l] * ground_mips.h[l] * sizeof(uint32_t);
+        h.normal[l] = snapshot_append(&w, ground_mips.normal[l], size);
+        h.albedo[l] = snapshot_append(&w, ground_mips.albedo[l], size);
+    }
+    h.in_place = h.normal[0];
+    h.size = w.size;
+    memcpy(w.data, &h, sizeof(h));
+
+    size_t from = offsetof(SnapshotHeader, size);
+    h.checksum = snapshot_checksum(w.data + from, h.in_place - from);
+    memcpy(w.data, &h, sizeof(h));
+
+    bool ok = snapshot_write_file(&w, path);
+    printf("snapshot: %s %s (%zu bytes)\n", ok ? "saved" : "failed to save", path, w.size);
+    snapshot_writer_destroy(&w);
+    return ok;
+}
+
+// Maps a snapshot and resumes from it. The G-buffer and its mips are used in place, everything else
+// is copied. Returns false, leaving the world untouched, if there is no usable snapshot.
+bool world_snapshot_load(const char* path) {
+    MappedFile f;
+    if (!snapshot_map(path, &f)) return false;
+
+    SnapshotHeader* h = (SnapshotHeader*)f.data;
+    size_t from = offsetof(SnapshotHeader, size);
+    const char* problem = NULL;
+    if (f.size < sizeof(SnapshotHeader) || h->magic != snapshot_magic) {
+        problem = "not a snapshot";
+    } else if (h->version != snapshot_version) {
+        problem = "different version";
+    } else if (h->world_x != world_x || h->world_y != world_y) {
+        problem = "different world size";
+    } else if (h->size != f.size || h->in_place < sizeof(SnapshotHeader) || h->in_place > f.size ||
+               h->checksum != snapshot_checksum(f.data + from, h->in_place - from)) {
+        problem = "checksum mismatch";
+    }
+    if (problem) {
+        printf("snapshot: %s in %s, regenerating the world\n", problem, path);
+        snapshot_unmap(&f);
+        return false;
+    }
+
+    time_ms = h->time_ms;
+    sun.angle = h->sun_angle;
+    camera.position = h->camera_position;
+    camera.size_x = h->camera_size_x;
+    camera.size_y = h->camera_size_y;
+
+    snapshot_load_slots(&f, &h->entities, &entities);
+    components_capacity = entities.capacity;
+    controlling = h->controlling;
+    position = (Vec2*)snapshot_copy(&f, h->position, components_capacity * sizeof(Vec2));
+    velocity = (Vec2*)snapshot_copy(&f, h->velocity, components_capacity * sizeof(Vec2));
+    shape = (Shape*)snapshot_copy(&f, h->shape, components_capacity * sizeof(Shape));
+    behavior = (Behavior*)snapshot_copy(&f, h->behavior, components_capacity * sizeof(Behavior));
+    entity_circle = (Circle*)malloc(components_capacity * sizeof(Circle));
+
+    snapshot_load_slots(&f, &h->light_slots, &light_slots);
+    lights_capacity = light_slots.capacity;
+    lights = (Light*)snapshot_copy(&f, h->lights, lights_capacity * sizeof(Light));
+    light_circle = (Circle*)malloc(lights_capacity * sizeof(Circle));
+
+    n_ground_sample = h->n_ground_sample;
+    memcpy(ground_sample, f.data + h->ground_sample, n_ground_sample * sizeof(GroundSample));
+    memcpy(sight.explored, f.data + h->explored, world_size);
+    ground_dynamics.moisture = snapshot_load_chunks(&f, &h->moisture);
+    ground.mat = snapshot_load_chunks(&f, &h->mat);
+    ground_index_build();
+
+    for (int l = 0; l < ground_mip_levels; ++l) {
+        ground_mips.normal[l] = (uint32_t*)(f.data + h->normal[l]);
+        ground_mips.albedo[l] = (uint32_t*)(f.data + h->albedo[l]);
+    }
+    rendering.normal = ground_mips.normal[0];
+    rendering.albedo = ground_mips.albedo[0];
+    ground_mips_init();
+
+    world_snapshot = f;
+    printf("snapshot: resumed from %s\n", path);
+    return true;
 }
 
-void world_init() {
-    int player_id = add_player();
-    controlling = player_id;
+// New world, the ground generates in the background
+void world_generate() {
+    controlling = add_player();
+
+    add_campfire({30, 20});
+    add_lamp({50, 40}, {-1, 0.5});
+    Vec2 creatures[] = {{19, 6}, {4, 17}, {16, 18}, {20, 12}};
+    for (Vec2 p : creatures) add_creature(p);
+
+    rendering.normal = (uint32_t*)world_calloc(world_size, sizeof(uint32_t));
+    rendering.albedo = (uint32_t*)world_calloc(world_size, sizeof(uint32_t));
+    ground.mat = chunk_grid_create(world_x, world_y, NONE);
+    ground_mips_init();
+    make_default_ground();
+}
 
-    add_tree({15, 10});
+// World size and the grids over it
+void world_set_size(int size_x, int size_y) {
+    world_x = size_x;
+    world_y = size_y;
+    world_size = world_x * world_y;
+    ground_buckets_x = (world_x + ground_bucket_size - 1) / ground_bucket_size;
+    ground_buckets_y = (world_y + ground_bucket_size - 1) / ground_bucket_size;
+    ground_tiles_x = (world_x + ground_tile_size - 1) / ground_tile_size;
+    ground_tiles_y = (world_y + ground_tile_size - 1) / ground_tile_size;
+    light_cache_tiles_x = (world_x + light_cache_tile_size - 1) / light_cache_tile_size;
+    light_cache_tiles_y = (world_y + light_cache_tile_size - 1) / light_cache_tile_size;
+    scenery_cells_x = (world_x + scenery_cell_size - 1) / scenery_cell_size;
+    scenery_cells_y = (world_y + scenery_cell_size - 1) / scenery_cell_size;
+    indirect_x = (world_x + indirect_cell_size - 1) / indirect_cell_size;
+    indirect_y = (world_y + indirect_cell_size - 1) / indirect_cell_size;
+    generation_tiles_x = (world_x + generation_tile_size - 1) / generation_tile_size;
+    generation_tiles_y = (world_y + generation_tile_size - 1) / generation_tile_size;
+    generation_tiles = generation_tiles_x * generation_tiles_y;
+    dynamics_chunks_x = (world_x + dynamics_chunk_size - 1) / dynamics_chunk_size;
+    dynamics_chunks_y = (world_y + dynamics_chunk_size - 1) / dynamics_chunk_size;
+    dynamics_chunks = dynamics_chunks_x * dynamics_chunks_y;
+
+    ground_index.offset = (int*)calloc(ground_buckets_x * ground_buckets_y + 1, sizeof(int));
+    light_cache.valid = (bool*)calloc(light_cache_tiles_x * light_cache_tiles_y, sizeof(bool));
+    int cells = indirect_x * indirect_y;
+    indirect.sun_inject = (Vec3*)calloc(cells, sizeof(Vec3));
+    indirect.inject = (Vec3*)calloc(cells, sizeof(Vec3));
+    indirect.transmit = (float*)calloc(cells, sizeof(float));
+    indirect.static_transmit = (float*)calloc(cells, sizeof(float));
+    indirect.radiance[0] = (Vec3*)calloc(cells, sizeof(Vec3));
+    indirect.radiance[1] = (Vec3*)calloc(cells, sizeof(Vec3));
+    indirect.exitant = (Vec3*)calloc(cells, sizeof(Vec3));
+    ground_generation.state = new std::atomic<uint8_t>[generation_tiles];
+    ground_dynamics.chunks = (DynamicsChunk*)calloc(dynamics_chunks, sizeof(DynamicsChunk));
+    ground_dynamics.active = (int*)malloc(dynamics_chunks * sizeof(int));
+}
 
+void world_init(int size_x, int size_y) {
+    world_set_size(size_x, size_y);
     camera.position = {0, 0};
     camera.size_x = 100;
     camera.size_y = 100;
@@ -304,11 +1852,34 @@ void world_init() {
 
     texture[GRASS] = texture_grass_create();
     texture[DIRT] = texture_dirt_create();
+    texture[WATER] = texture_water_create();
+    texture[MUD] = texture_mud_create();
+
+    light_cache.color = (uint32_t*)world_calloc(world_size, sizeof(uint32_t));
+    light_cache_invalidate_all();
+
+    // No scenery until the worker has scattered it
+    scenery_alloc(&scenery);
+    indirect_add_scenery();
+    sight_trees = (uint8_t*)world_calloc(world_size, 1);
+    sight = fov_create(world_x, world_y, sight_radius, sight_trees);
+    if (!sight.movers || !sight.visible || !sight.explored) {
+        printf("world: out of memory for the sight of a %dx%d world\n", world_x, world_y);
+        abort();
+    }
 
-    rendering.normal = (Vec3*)malloc(world_size*sizeof(Vec3));
-    rendering.albedo = (Vec3*)malloc(world_size*sizeof(Vec3));
-    ground.mat = (GroundType*)malloc(world_size*sizeof(GroundType));
-    make_default_ground();
+    if (world_snapshot_load(world_snapshot_path)) {
+        ground_generation_start(false);
+    } else {
+        world_generate();
+    }
+
+    torch_visibility = angular_depth_create(torch_angle_bins);
+    torch_buffer = (float*)calloc(camera.res_x * camera.res_y, sizeof(float));
+    dynamic_resolution.scene = img_create(camera.res_x, camera.res_y);
+    view = camera;
+
+    thread_pool_init(0);
 }
 
 void resolve_collision(int a, int b) {
@@ -328,6 +1899,9 @@ void resolve_collision(int a, int b) {
 }
 
 void world_update(float dt) {
+    ground_generation_poll();
+    ground_dynamics_update(dt);
+
     time_ms += time_scaling * dt * 1000;
     ms_accumulated += time_scaling * dt * 1000;
     if (ms_accumulated > 1000) {
@@ -354,115 +1928,259 @@ void world_update(float dt) {
         vel.y = 1;
     }
 
+    int player = entity_index(&entities, controlling);
     if (!is_zero(vel)) {
         vel = normalize(vel) * speed;
+        player_path_n = 0;
+    } else if (player_path_next < player_path_n) {
+        // Head for the center of the next cell, close enough counts as reached
+        PathCell c = player_path[player_path_next];
+        Vec2 to = Vec2{c.x + 0.5f, c.y + 0.5f} - position[player];
+        if (vec2_norm(to) < 0.5f) player_path_next++;
+        if (!is_zero(to)) vel = std::min(speed, vec2_norm(to) / dt) * normalize(to);
     }
 
-    Vec2 p = position[controlling] + vel * dt;
+    Vec2 p = position[player] + vel * dt;
 
-    int world_xy = (int)p.y * world_x + (int)p.x;
-    if (ground.mat[world_xy] == WATER) {
-        p = position[controlling];
+    if (ground_at((int)p.x, (int)p.y) == WATER) {
+        p = position[player];
     }
 
-    velocity[controlling] = vel;
-    position[controlling] = p; // position[controlling] + velocity[controlling] * dt;
+    velocity[player] = vel;
+    position[player] = p; // position[player] + velocity[player] * dt;
 
-    for (int id_a = 0; id_a < n_ids; ++id_a) {
-        for (int id_b = id_a + 1; id_b < n_ids; ++id_b) {
-            resolve_collision(id_a, id_b);
+    if (creature_flow.running) {
+        const FlowField* flow = flow_field_update(&creature_flow, {(int)p.x, (int)p.y});
+        for (int i = 0; i < entities.n; ++i) {
+            if (behavior[i] != BEHAVIOR_SEEK_PLAYER) continue;
+            Vec2 v = {};
+            if (vec2_norm(position[player] - position[i]) > creature_keep_distance) {
+                v = flow_field_sample(flow, position[i]) * creature_speed;
+            }
+            Vec2 q = position[i] + v * dt;
+            velocity[i] = v;
+            if (ground_at((int)q.x, (int)q.y) != WATER) position[i] = q;
         }
     }
 
+    if (entities.n > sight_movers_capacity) {
+        sight_movers_capacity = entities.capacity;
+        sight_movers = (PathCell*)realloc(sight_movers, sight_movers_capacity * sizeof(PathCell));
+    }
+    int n_movers = 0;
+    for (int i = 0; i < entities.n; ++i) {
+        if (i != player) sight_movers[n_movers++] = {(int)floorf(position[i].x), (int)floorf(position[i].y)};
+    }
+    fov_set_movers(&sight, sight_movers, n_movers);
+    fov_update(&sight, {(int)floorf(p.x), (int)floorf(p.y)});
+
+    broadphase_find_pairs(&broadphase, entity_circles(), entities.n);
+    for (int i = 0; i < broadphase.n_pairs; ++i) {
+        resolve_collision(broadphase.pairs[i].a, broadphase.pairs[i].b);
+    }
+    for (int i = 0; i < entities.n; ++i) {
+        if (!is_zero(velocity[i])) resolve_scenery_collisions(i);
+    }
+
 
-    camera.position = position[controlling] - Vec2{camera.size_x / 2, camera.size_y / 2};
+    camera.position = position[player] - Vec2{camera.size_x / 2, camera.size_y / 2};
 
     sun_update_angle();
 }
 
-Vec3 torch_light(Vec2 point_pos) {
-    float min_dot = 0.8;
-    float max_distance = 50;
-
-    Vec2 torch_pos = position[controlling];
-    Vec2 torch_to_point = vec2_sub(point_pos, torch_pos);
-    float distance_torch_point = vec2_norm(torch_to_point);
+// Builds the torch visibility polygon against every other entity, then fills the lit cone into
+// `torch_buffer`. Only pixels within reach of the torch are touched, world_draw reads one value.
+void torch_light_pass() {
+    int player = entity_index(&entities, controlling);
+    Vec2 torch_pos = position[player];
+
+    // Entities but the player, and the scenery in reach
+    int n_occluders = 0;
+    auto add_occluder = [&](Circle c) {
+        if (n_occluders == torch_occluders_capacity) {
+            torch_occluders_capacity = std::max(256, 2 * torch_occluders_capacity);
+            torch_occluders = (Circle*)realloc(torch_occluders, torch_occluders_capacity * sizeof(Circle));
+        }
+        torch_occluders[n_occluders++] = c;
+    };
+    Circle* circles = entity_circles();
+    for (int i = 0; i < entities.n; ++i) {
+        if (i != player) add_occluder(circles[i]);
+    }
+    float occluder_reach = torch_max_distance + scenery_max_radius;
+    Vec2 occluder_box = {occluder_reach, occluder_reach};
+    scenery_for_each(torch_pos - occluder_box, torch_pos + occluder_box, [&](int i) {
+        add_occluder({scenery.position[i], scenery.shape[i].radius});
+    });
+    angular_depth_compute(&torch_visibility, torch_pos, torch_max_distance, torch_occluders, n_occluders);
+
+    for (int y = torch_lit.y0; y < torch_lit.y1; ++y)
+        for (int x = torch_lit.x0; x < torch_lit.x1; ++x) {
+            torch_buffer[y * view.res_x + x] = 0;
+        }
 
-    Vec2 torch_to_point_normalized = vec2_div(torch_to_point, distance_torch_point);
-    Vec2 perp = {torch_to_point_normalized.y, -torch_to_point_normalized.x};
+    // The mouse is in window pixels, the buffer at the internal render resolution
+    Vec2 mouse = multiply_affine_vec2(inverse(camera.view_transform()), controls.mouse);
+    Vec2 torch_dir = normalize(mouse - torch_pos);
 
-    bool in_shadow = false;
-    for (int i = 0; i < n_ids; ++i) {
-        if (i == controlling)
-            continue;
+    Affine t = view.view_transform();
+    Affine ti = inverse(t);
 
-        Shape s = shape[i];
-        if (s.type == CIRCLE) {
-            Vec2 shape_pos = position[i];
+    Vec2 reach = {torch_max_distance, torch_max_distance};
+    Vec2 top_left = multiply_affine_vec2(t, torch_pos - reach);
+    Vec2 bottom_right = multiply_affine_vec2(t, torch_pos + reach);
+    torch_lit = {
+        clampi((int)floorf(top_left.x), 0, view.res_x),
+        clampi((int)floorf(top_left.y), 0, view.res_y),
+        clampi((int)ceilf(bottom_right.x), 0, view.res_x),
+        clampi((int)ceilf(bottom_right.y), 0, view.res_y),
+    };
+
+    // The view transform has no rotation, stepping one pixel moves by a constant in world space
+    Vec2 step = {ti.m.m00, ti.m.m10};
+    for (int y = torch_lit.y0; y < torch_lit.y1; ++y) {
+        Vec2 point_pos = multiply_affine_vec2(ti, {(float)torch_lit.x0, (float)y});
+        for (int x = torch_lit.x0; x < torch_lit.x1; ++x, point_pos = point_pos + step) {
+            Vec2 torch_to_point = point_pos - torch_pos;
+            float distance_torch_point = vec2_norm(torch_to_point);
+            if (distance_torch_point >= torch_max_distance) continue;
+
+            float d = vec2_dot(torch_to_point, torch_dir) / distance_torch_point;
+            if (d <= torch_min_dot) continue;
+
+            int bin = angular_depth_bin(&torch_visibility, torch_to_point);
+            if (distance_torch_point >= torch_visibility.depth[bin]) continue;
+
+            float distance_intensity = 1 - sqrt(distance_torch_point / torch_max_distance);
+            float beam_intensity = sqrt(d - torch_min_dot);
+            torch_buffer[y * view.res_x + x] = clampf(3 * beam_intensity * distance_intensity, 0, 1);
+        }
+    }
+}
 
-            if (vec2_norm(vec2_sub(shape_pos, point_pos)) < s.radius) {
-                in_shadow = true;
-                break;
-            }
+// Rasterizes the scenery shadows over a light cache tile into scenery.shadow
+void scenery_bake_shadow(int x0, int y0, int x1, int y1, Vec3 sun_vec) {
+    float reach = shadow_max_length + scenery_max_radius;
+    int n = 0;
+    int capacity = 256;
+    Circle* casters = (Circle*)malloc(capacity * sizeof(Circle));
+    scenery_for_each({x0 - reach, y0 - scenery_max_radius}, {x1 + reach, y1 + scenery_max_radius}, [&](int i) {
+        if (n == capacity) {
+            capacity *= 2;
+            casters = (Circle*)realloc(casters, capacity * sizeof(Circle));
+        }
+        casters[n++] = {scenery.position[i], scenery.shape[i].radius};
+    });
+
+    bool shadow[light_cache_tile_size * light_cache_tile_size];
+    ShadowMask mask = {.w = x1 - x0, .h = y1 - y0, .data = shadow};
+    shadow_mask_rasterize(&mask, from_translation({(float)-x0, (float)-y0}), sun_vec, shadow_max_length, casters, n,
+                          sun_shadow_shape);
+    for (int y = y0; y < y1; ++y) memcpy(scenery.shadow + y * world_x + x0, shadow + (y - y0) * mask.w, mask.w);
+    free(casters);
+}
 
-            Vec2 torch_to_shape = vec2_sub(shape_pos, torch_pos);
-            if (distance_torch_point < vec2_norm(torch_to_shape))
-                continue;
+void light_cache_relight_tile(int task, void* data) {
+    RelightParams* p = (RelightParams*)data;
+    int tile = p->tiles[task];
+    int x0 = (tile % light_cache_tiles_x) * light_cache_tile_size;
+    int y0 = (tile / light_cache_tiles_x) * light_cache_tile_size;
+    int x1 = std::min(x0 + light_cache_tile_size, world_x);
+    int y1 = std::min(y0 + light_cache_tile_size, world_y);
+
+    if (scenery.shadow_angle[tile] != p->sun_angle) {
+        scenery_bake_shadow(x0, y0, x1, y1, p->sun_vec);
+        scenery.shadow_angle[tile] = p->sun_angle;
+    }
 
-            if (vec2_dot(torch_to_shape, torch_to_point) < 0)
-                continue;
+    // Dynamic entities only, the scenery is baked
+    bool shadow[light_cache_tile_size * light_cache_tile_size];
+    ShadowMask mask = {.w = x1 - x0, .h = y1 - y0, .data = shadow};
+    shadow_mask_rasterize(&mask, from_translation({(float)-x0, (float)-y0}), p->sun_vec, shadow_max_length,
+                          p->casters, p->n_casters, sun_shadow_shape);
 
-            float distance_line_origin = vec2_dot(perp, torch_to_shape);
-            if (fabsf(distance_line_origin) < s.radius) {
-                // printf("d: %f\n", distance_line_origin);
-                in_shadow = true;
-                break;
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            int xy = y * world_x + x;
+            Vec3 illumination = ambient_light;
+            if (!shadow[(y - y0) * mask.w + (x - x0)] && !scenery.shadow[xy]) {
+                float diffuse = fmax(0, vec3_dot(normal_decode(rendering.normal[xy]), p->sun_vec));
+                illumination = vec3_add(illumination, vec3_scale(p->sun_color, diffuse));
             }
+            light_cache.color[xy] = albedo_encode(vec3_mul(illumination, albedo_decode(rendering.albedo[xy])));
         }
-    }
-    if (in_shadow)
-        return {0, 0, 0};
+    ground_mips_update(ground_mips.lit, false, x0, y0, x1, y1);
 
-    Vec2 mouse = multiply_affine_vec2(inverse(camera.view_transform()), controls.mouse);
-    Vec2 torch_dir = normalize(mouse - torch_pos);
-    float distance_intensity = fmaxf(0, fminf(1, (1 - sqrt(distance_torch_point / max_distance))));
-    float d = vec2_dot(torch_to_point_normalized, torch_dir);
-    float beam_intensity = fmaxf(0, sqrt(d - min_dot));
-    float intensity = clampf(3 * beam_intensity * distance_intensity, 0, 1);
-    return vec3_scale({1, 1, 1}, intensity);
+    light_cache.valid[tile] = true;
 }
 
-bool is_occluded(Vec3 light_pos, Vec3 point_pos) {
-    // Optimization: look at objects within a margin of viewing region
-    Vec3 point_to_light = vec3_sub(light_pos, point_pos);
-    float dist_point_light = vec3_norm(point_to_light);
-    Vec3 point_to_light_normalized = vec3_div(point_to_light, dist_point_light);
-
-    for (int i = 0; i < n_ids; ++i) {
-        // Considering every object as a sphere
-        Shape s = shape[i];
+// The sun turns once per game day. A fixed angle would relight the visible tiles several times a
+// second at high time rates, so the threshold follows the time rate and a relight covers about
+// light_cache_sun_interval of real time.
+float light_cache_max_sun_delta() {
+    float per_second = 2 * M_PI * time_scaling / (24 * 3600);
+    return fmaxf(light_cache_min_sun_delta, per_second * light_cache_sun_interval);
+}
 
-        Vec2 shape_pos_2d = position[i];
-        Vec3 shape_pos = {shape_pos_2d.x, shape_pos_2d.y, 0};
+// Invalidates what changed since the cache was lit, then relights the visible tiles that need it
+void light_cache_update() {
+    Circle* casters = entity_circles();
+    int n_casters = entities.n;
 
-        if (vec3_norm(vec3_sub(shape_pos, point_pos)) < s.radius) {
-            continue;
+    if (fabsf(sun.angle - light_cache.sun_angle) > light_cache_max_sun_delta()) {
+        light_cache_invalidate_all();
+        light_cache.sun_angle = sun.angle;
+    } else {
+        // Both where the shadow was and where it is now
+        Vec3 cached_sun_vec = {cos(light_cache.sun_angle), 0, sin(light_cache.sun_angle)};
+        for (int i = 0; i < std::max(n_casters, light_cache.n_casters); ++i) {
+            bool existed = i < light_cache.n_casters;
+            bool exists = i < n_casters;
+            if (existed && exists && light_cache.casters[i].center.x == casters[i].center.x &&
+                light_cache.casters[i].center.y == casters[i].center.y &&
+                light_cache.casters[i].radius == casters[i].radius)
+                continue;
+            if (existed) light_cache_invalidate_shadow(light_cache.casters[i], cached_sun_vec);
+            if (exists) light_cache_invalidate_shadow(casters[i], cached_sun_vec);
         }
-
-        Vec3 point_to_shape = vec3_sub(shape_pos, point_pos);
-        float dist_shape_light = vec3_norm(vec3_sub(shape_pos, light_pos));
-        if (dist_point_light < dist_shape_light) continue;
-
-        Vec3 shape_on_line = vec3_project_onto(point_to_shape, point_to_light_normalized);
-
-        // Use a p-norm to simulate a cube instead of a sphere, square shadows look more realistic (and
-        // more compatible with a lot of different shapes)
-        float dist_shape_line = vec3_pnorm(8, vec3_sub(point_to_shape, shape_on_line));
-        if (dist_shape_line < s.radius)
-            return true;
     }
+    if (n_casters > light_cache.casters_capacity) {
+        light_cache.casters_capacity = components_capacity;
+        light_cache.casters = (Circle*)realloc(light_cache.casters, light_cache.casters_capacity * sizeof(Circle));
+    }
+    light_cache.n_casters = n_casters;
+    for (int i = 0; i < n_casters; ++i) light_cache.casters[i] = casters[i];
+
+    // Visible tiles that need relighting
+    Affine ti = inverse(camera.view_transform());
+    Vec2 top_left = multiply_affine_vec2(ti, {0, 0});
+    Vec2 bottom_right = multiply_affine_vec2(ti, {(float)camera.res_x, (float)camera.res_y});
+    int tx0 = clampi((int)floorf(top_left.x / light_cache_tile_size), 0, light_cache_tiles_x - 1);
+    int ty0 = clampi((int)floorf(top_left.y / light_cache_tile_size), 0, light_cache_tiles_y - 1);
+    int tx1 = clampi((int)floorf(bottom_right.x / light_cache_tile_size), 0, light_cache_tiles_x - 1);
+    int ty1 = clampi((int)floorf(bottom_right.y / light_cache_tile_size), 0, light_cache_tiles_y - 1);
+
+    int* tiles = (int*)malloc((tx1 - tx0 + 1) * (ty1 - ty0 + 1) * sizeof(int));
+    int n_tiles = 0;
+    for (int ty = ty0; ty <= ty1; ++ty)
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            int t = ty * light_cache_tiles_x + tx;
+            if (!light_cache.valid[t]) tiles[n_tiles++] = t;
+        }
 
-    return false;
+    // Everything in the cache is lit with the same sun, even if it moved a little since
+    float angle = light_cache.sun_angle;
+    RGB sun_color_rgb = kelvin_to_color(sun_temperature_from_angle(angle));
+    RelightParams params = {
+        .tiles = tiles,
+        .sun_angle = angle,
+        .sun_vec = {cos(angle), 0, sin(angle)},
+        .sun_color = {sun_color_rgb.r, sun_color_rgb.g, sun_color_rgb.b},
+        .casters = casters,
+        .n_casters = n_casters,
+    };
+    thread_pool_run(n_tiles, light_cache_relight_tile, &params);
+    free(tiles);
 }
 
 // void render_ground() {
@@ -494,44 +2212,475 @@ bool is_occluded(Vec3 light_pos, Vec3 point_pos) {
 //         }
 // }
 
-void world_draw() {
-    Affine t = camera.view_transform();
-    Affine ti = inverse(t);
-    
-    // render_ground();
-    // gfx_draw_sprite(&ground_sprite, t, false);
+// Averages the cached direct light over the cells of a band of rows. Cells whose cache tile isn't
+// lit keep their previous value.
+void indirect_inject_sun(int row0, int row1) {
+    for (int cy = row0; cy < row1; ++cy) {
+        for (int cx = 0; cx < indirect_x; ++cx) {
+            int x0 = cx * indirect_cell_size;
+            int y0 = cy * indirect_cell_size;
+            int t = (y0 / light_cache_tile_size) * light_cache_tiles_x + x0 / light_cache_tile_size;
+            if (!light_cache.valid[t]) continue;
+
+            int x1 = std::min(x0 + indirect_cell_size, world_x);
+            int y1 = std::min(y0 + indirect_cell_size, world_y);
+            Vec3 sum = {};
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) sum = vec3_add(sum, albedo_decode(light_cache.color[y * world_x + x]));
+            indirect.sun_inject[cy * indirect_x + cx] = vec3_div(sum, (x1 - x0) * (y1 - y0));
+        }
+    }
+}
 
-    Vec3 ambient_light = vec3_scale({1, 1, 1}, 0.1);
-    Vec3 sun_vec = {cos(sun.angle), 0, sin(sun.angle)};
-    RGB sun_color_rgb = kelvin_to_color(sun_temperature_from_angle(sun.angle));
-    Vec3 sun_color = {sun_color_rgb.r, sun_color_rgb.g, sun_color_rgb.b};
-    Vec3 sun_pos_3d = vec3_scale(sun_vec, 1000);
-    for (int y = 0; y < camera.res_y; ++y)
-        for (int x = 0; x < camera.res_x; ++x) {
-            Vec2 world_pos = multiply_affine_vec2(ti, {(float)x, (float)y});
+// Light reflected by the ground at the center of a cell
+Vec3 indirect_reflect(int cell, Vec3 incident) {
+    int x = std::min((cell % indirect_x) * indirect_cell_size + indirect_cell_size / 2, world_x - 1);
+    int y = std::min((cell / indirect_x) * indirect_cell_size + indirect_cell_size / 2, world_y - 1);
+    return vec3_mul(incident, albedo_decode(rendering.albedo[y * world_x + x]));
+}
 
-            if (world_pos.x < 0 || world_pos.y < 0 || world_pos.x >= world_x || world_pos.y >= world_y)
-                continue;
+void indirect_update() {
+    int row1 = std::min(indirect.next_row + indirect_rows_per_frame, indirect_y);
+    indirect_inject_sun(indirect.next_row, row1);
+    indirect.next_row = row1 == indirect_y ? 0 : row1;
 
-            Vec3 illumination = ambient_light;
+    memcpy(indirect.inject, indirect.sun_inject, indirect_x * indirect_y * sizeof(Vec3));
 
-            illumination = vec3_add(illumination, torch_light(world_pos));
+    // The torch, with the same cone and visibility as torch_light_pass
+    int player = entity_index(&entities, controlling);
+    Vec2 torch_pos = position[player];
+    Vec2 mouse = multiply_affine_vec2(inverse(camera.view_transform()), controls.mouse);
+    Vec2 torch_dir = normalize(mouse - torch_pos);
+    int reach = (int)ceilf(torch_max_distance / indirect_cell_size);
+    int tcx = (int)(torch_pos.x / indirect_cell_size);
+    int tcy = (int)(torch_pos.y / indirect_cell_size);
+    for (int cy = std::max(tcy - reach, 0); cy <= std::min(tcy + reach, indirect_y - 1); ++cy) {
+        for (int cx = std::max(tcx - reach, 0); cx <= std::min(tcx + reach, indirect_x - 1); ++cx) {
+            Vec2 center = {(cx + 0.5f) * indirect_cell_size, (cy + 0.5f) * indirect_cell_size};
+            Vec2 torch_to_cell = center - torch_pos;
+            float distance = vec2_norm(torch_to_cell);
+            if (distance >= torch_max_distance || distance == 0) continue;
+            float d = vec2_dot(torch_to_cell, torch_dir) / distance;
+            if (d <= torch_min_dot) continue;
+            if (distance >= torch_visibility.depth[angular_depth_bin(&torch_visibility, torch_to_cell)]) continue;
+
+            float intensity = clampf(3 * sqrtf(d - torch_min_dot) * (1 - sqrtf(distance / torch_max_distance)), 0, 1);
+            int cell = cy * indirect_x + cx;
+            indirect.inject[cell] = vec3_add(indirect.inject[cell], indirect_reflect(cell, {intensity, intensity, intensity}));
+        }
+    }
 
-            int xy = (int)world_pos.y * world_x + (int)world_pos.x;
-            Vec3 normal = rendering.normal[xy];
-            // vec3_print("normal", normal);
-            Vec3 point_3d = {world_pos.x, world_pos.y, 0};
-            if (!is_occluded(sun_pos_3d, point_3d)) {
-                float diffuse = fmax(0, vec3_dot(normal, sun_vec));
-                Vec3 sun_light = vec3_scale(sun_color, diffuse);
-                illumination = vec3_add(illumination, sun_light);
+    // Lights, falloff only
+    for (int i = 0; i < light_slots.n; ++i) {
+        Light* l = &lights[i];
+        int x0 = std::max((int)((l->position.x - l->radius) / indirect_cell_size), 0);
+        int y0 = std::max((int)((l->position.y - l->radius) / indirect_cell_size), 0);
+        int x1 = std::min((int)((l->position.x + l->radius) / indirect_cell_size), indirect_x - 1);
+        int y1 = std::min((int)((l->position.y + l->radius) / indirect_cell_size), indirect_y - 1);
+        for (int cy = y0; cy <= y1; ++cy) {
+            for (int cx = x0; cx <= x1; ++cx) {
+                Vec2 center = {(cx + 0.5f) * indirect_cell_size, (cy + 0.5f) * indirect_cell_size};
+                Vec2 to_cell = center - l->position;
+                float falloff = clampf(1 - vec2_dot(to_cell, to_cell) / (l->radius * l->radius), 0, 1);
+                int cell = cy * indirect_x + cx;
+                indirect.inject[cell] = vec3_add(indirect.inject[cell], indirect_reflect(cell, vec3_scale(l->color, falloff * falloff)));
             }
+        }
+    }
 
-            Vec3 albedo = rendering.albedo[xy];
-            Vec3 shaded = vec3_mul(illumination, albedo);
+    // Entities block light in proportion to the part of the cell they cover
+    memcpy(indirect.transmit, indirect.static_transmit, indirect_x * indirect_y * sizeof(float));
+    for (int i = 0; i < entities.n; ++i) {
+        int cx = (int)(position[i].x / indirect_cell_size);
+        int cy = (int)(position[i].y / indirect_cell_size);
+        if (cx < 0 || cy < 0 || cx >= indirect_x || cy >= indirect_y) continue;
+        float coverage = M_PI * shape[i].radius * shape[i].radius / (indirect_cell_size * indirect_cell_size);
+        float* t = &indirect.transmit[cy * indirect_x + cx];
+        *t = fmaxf(*t - coverage, 0);
+    }
+
+    for (int iteration = 0; iteration < indirect_iterations; ++iteration) {
+        Vec3* from = indirect.radiance[indirect.current];
+        Vec3* to = indirect.radiance[1 - indirect.current];
+        // Light leaving a cell is what it reflects plus what it passes on
+        for (int i = 0; i < indirect_x * indirect_y; ++i) {
+            indirect.exitant[i] = vec3_scale(vec3_add(indirect.inject[i], from[i]), indirect.transmit[i]);
+        }
+        Vec3* e = indirect.exitant;
+        for (int cy = 0; cy < indirect_y; ++cy) {
+            for (int cx = 0; cx < indirect_x; ++cx) {
+                int c = cy * indirect_x + cx;
+                Vec3 sum = {};
+                int n = 0;
+                if (cx > 0) sum = vec3_add(sum, e[c - 1]), n++;
+                if (cx < indirect_x - 1) sum = vec3_add(sum, e[c + 1]), n++;
+                if (cy > 0) sum = vec3_add(sum, e[c - indirect_x]), n++;
+                if (cy < indirect_y - 1) sum = vec3_add(sum, e[c + indirect_x]), n++;
+                sum = vec3_scale(sum, indirect_transfer / n);
+                // Far from any light this decays into denormals, which are very slow
+                to[c] = sum.x + sum.y + sum.z < 1e-6f ? Vec3{} : sum;
+            }
+        }
+        indirect.current = 1 - indirect.current;
+    }
+}
 
-            gfx_set(x, y, rgba_clamp({shaded.x, shaded.y, shaded.z, 1}));
+// Bilinear sample of the indirect light at eight world positions. The corners are gathered per
+// lane, the interpolation runs in vector registers like the rest of the shading.
+void indirect_sample8(f32x8 wx, f32x8 wy, f32x8* r, f32x8* g, f32x8* b) {
+    f32x8 gx = f32x8_clamp(wx * (1.f / indirect_cell_size) - 0.5f, 0, indirect_x - 1);
+    f32x8 gy = f32x8_clamp(wy * (1.f / indirect_cell_size) - 0.5f, 0, indirect_y - 1);
+    // Non-negative, so truncation is the floor
+    i32x8 x0 = __builtin_convertvector(gx, i32x8);
+    i32x8 y0 = __builtin_convertvector(gy, i32x8);
+    f32x8 fx = gx - f32x8_from_i32x8(x0);
+    f32x8 fy = gy - f32x8_from_i32x8(y0);
+    // Offsets to the right and bottom corners, zero on the last column and row. Comparison masks
+    // are -1 where true.
+    i32x8 i00 = y0 * indirect_x + x0;
+    i32x8 right = -(x0 < indirect_x - 1);
+    i32x8 down = -(y0 < indirect_y - 1) * indirect_x;
+
+    Vec3* radiance = indirect.radiance[indirect.current];
+    f32x8 corner[4][3];
+    for (int l = 0; l < simd_width; ++l) {
+        int i[4] = {i00[l], i00[l] + right[l], i00[l] + down[l], i00[l] + right[l] + down[l]};
+        for (int k = 0; k < 4; ++k) {
+            Vec3 v = radiance[i[k]];
+            corner[k][0][l] = v.x;
+            corner[k][1][l] = v.y;
+            corner[k][2][l] = v.z;
         }
+    }
+    f32x8* out[3] = {r, g, b};
+    for (int c = 0; c < 3; ++c) {
+        f32x8 top = f32x8_lerp(corner[0][c], corner[1][c], fx);
+        f32x8 bottom = f32x8_lerp(corner[2][c], corner[3][c], fx);
+        *out[c] = f32x8_lerp(top, bottom, fy) * indirect_strength;
+    }
+}
+
+// Bins circles into the screen tiles their bounding squares overlap. Two passes over the circles,
+// counting then filling, so a tile's circles are contiguous and in order. 
+// `margin` is in world units and added to every radius.
+void tile_bins_build(TileBins* b, Circle* circles, int n_circles, float margin, Affine t, int tiles_x, int tiles_y) {
+    b->n_tiles = tiles_x * tiles_y;
+    if (b->n_tiles + 1 > b->tiles_capacity) {
+        b->tiles_capacity = b->n_tiles + 1;
+        b->offset = (int*)realloc(b->offset, b->tiles_capacity * sizeof(int));
+    }
+    memset(b->offset, 0, (b->n_tiles + 1) * sizeof(int));
+
+    auto tile_range = [&](Circle c, ScreenRect* r) {
+        Vec2 reach = {c.radius + margin, c.radius + margin};
+        Vec2 top_left = multiply_affine_vec2(t, c.center - reach);
+        Vec2 bottom_right = multiply_affine_vec2(t, c.center + reach);
+        r->x0 = clampi((int)floorf(top_left.x / draw_tile_size), 0, tiles_x);
+        r->y0 = clampi((int)floorf(top_left.y / draw_tile_size), 0, tiles_y);
+        r->x1 = clampi((int)floorf(bottom_right.x / draw_tile_size) + 1, 0, tiles_x);
+        r->y1 = clampi((int)floorf(bottom_right.y / draw_tile_size) + 1, 0, tiles_y);
+    };
+
+    for (int i = 0; i < n_circles; ++i) {
+        ScreenRect r;
+        tile_range(circles[i], &r);
+        for (int y = r.y0; y < r.y1; ++y)
+            for (int x = r.x0; x < r.x1; ++x) b->offset[y * tiles_x + x + 1]++;
+    }
+    for (int i = 0; i < b->n_tiles; ++i) b->offset[i + 1] += b->offset[i];
+
+    int n = b->offset[b->n_tiles];
+    if (n > b->index_capacity) {
+        b->index_capacity = std::max(n, 2 * b->index_capacity);
+        b->index = (int*)realloc(b->index, b->index_capacity * sizeof(int));
+    }
+    // offset[t] is the fill cursor of tile t and ends up at the start of t + 1, shift it back
+    for (int i = 0; i < n_circles; ++i) {
+        ScreenRect r;
+        tile_range(circles[i], &r);
+        for (int y = r.y0; y < r.y1; ++y)
+            for (int x = r.x0; x < r.x1; ++x) b->index[b->offset[y * tiles_x + x]++] = i;
+    }
+    for (int i = b->n_tiles; i > 0; --i) b->offset[i] = b->offset[i - 1];
+    b->offset[0] = 0;
+}
+
+// Adds the binned lights of one tile to the light of eight pixels at (wx, wy)
+void accumulate_lights(int tile, f32x8 wx, f32x8 wy, u32x8 normal_packed, f32x8* r, f32x8* g, f32x8* b) {
+    f32x8 nx, ny, nz;
+    normal_decode8(normal_packed, &nx, &ny, &nz);
+    for (int i = light_bins.offset[tile]; i < light_bins.offset[tile + 1]; ++i) {
+        Light* light = &lights[light_bins.index[i]];
+        f32x8 dx = wx - light->position.x;
+        f32x8 dy = wy - light->position.y;
+        f32x8 d2 = dx * dx + dy * dy;
+        f32x8 falloff = f32x8_clamp(1 - d2 / (light->radius * light->radius), 0, 1);
+        falloff *= falloff;
+        f32x8 distance = f32x8_sqrt(d2 + light->height * light->height);
+        f32x8 diffuse = f32x8_clamp((nz * light->height - nx * dx - ny * dy) / distance, 0, 1);
+        f32x8 intensity = falloff * diffuse;
+        if (light->type == SPOT_LIGHT) {
+            f32x8 cos_angle = (dx * light->direction.x + dy * light->direction.y) / f32x8_sqrt(d2 + 1e-6f);
+            f32x8 cone = (cos_angle - light->cos_outer) / (light->cos_inner - light->cos_outer);
+            intensity *= f32x8_smoothstep(f32x8_clamp(cone, 0, 1));
+        }
+        *r += intensity * light->color.x;
+        *g += intensity * light->color.y;
+        *b += intensity * light->color.z;
+    }
+}
+
+// Signed distance from `p`, relative to the center of the shape, to its outline
+float shape_distance(Shape* s, Vec2 p) {
+    switch (s->type) {
+        case CIRCLE: return vec2_norm(p) - s->radius;
+        case BOX: {
+            Vec2 d = {fabsf(p.x) - s->size.x, fabsf(p.y) - s->size.y};
+            return vec2_norm({fmaxf(d.x, 0), fmaxf(d.y, 0)}) + fminf(fmaxf(d.x, d.y), 0);
+        }
+        case CAPSULE: {
+            float x = clampf(p.x, -s->size.x, s->size.x);
+            return vec2_norm({p.x - x, p.y}) - s->size.y;
+        }
+    }
+    return 0;
+}
+
+// Draws the shapes binned to a tile over the shaded ground, in order. Bins index `ids` or the
+// arrays directly if it's NULL. Coverage is the distance to the outline in pixels, which
+// anti-aliases edges without extra samples.
+void draw_shapes_tile(ShadeParams* p, int tile, int x0, int y0, int x1, int y1, TileBins* bins, int* ids,
+                      Vec2* position, Shape* shape) {
+    float pixel = p->ti.m.m00;  // world units per pixel
+    for (int i = bins->offset[tile]; i < bins->offset[tile + 1]; ++i) {
+        int e = ids ? ids[bins->index[i]] : bins->index[i];
+        Shape* s = &shape[e];
+        Vec2 reach = {s->radius + pixel, s->radius + pixel};
+        Vec2 top_left = multiply_affine_vec2(p->t, position[e] - reach);
+        Vec2 bottom_right = multiply_affine_vec2(p->t, position[e] + reach);
+        int bx0 = std::max((int)floorf(top_left.x), x0);
+        int by0 = std::max((int)floorf(top_left.y), y0);
+        int bx1 = std::min((int)ceilf(bottom_right.x), x1);
+        int by1 = std::min((int)ceilf(bottom_right.y), y1);
+
+        RGBA color = {s->color.r * p->entity_light.x, s->color.g * p->entity_light.y, s->color.b * p->entity_light.z, 1};
+        color = rgba_clamp(color);
+        for (int y = by0; y < by1; ++y) {
+            RGBA* out = p->fb->data + y * p->fb->w;
+            for (int x = bx0; x < bx1; ++x) {
+                Vec2 w = multiply_affine_vec2(p->ti, {x + 0.5f, y + 0.5f});
+                float coverage = clampf(0.5f - shape_distance(s, w - position[e]) / pixel, 0, 1);
+                if (coverage == 0) continue;
+                out[x] = rgba_add(rgba_scale(out[x], 1 - coverage), rgba_scale(color, coverage));
+            }
+        }
+    }
+}
+
+// Pixels are independent, so the result doesn't depend on how tiles are spread over threads
+void world_shade_tile(int tile, void* data) {
+    ShadeParams* p = (ShadeParams*)data;
+    int x0 = (tile % p->tiles_x) * draw_tile_size;
+    int y0 = (tile / p->tiles_x) * draw_tile_size;
+    int x1 = std::min(x0 + draw_tile_size, view.res_x);
+    int y1 = std::min(y0 + draw_tile_size, view.res_y);
+
+    // Eight pixels per step: cache and G-buffer texels are gathered, then decoded in vector registers.
+    // The view has no rotation so world coordinates advance by a constant step along the row.
+    Vec2 step = {p->ti.m.m00, p->ti.m.m10};
+    f32x8 lane = f32x8_ramp(0, 1);
+    bool has_lights = light_bins.offset[tile + 1] > light_bins.offset[tile];
+    int level = p->level;
+    int level_w = ground_mips.w[level];
+    uint32_t* lit = ground_mips.lit[level];
+    uint32_t* albedo = ground_mips.albedo[level];
+    uint32_t* normal = ground_mips.normal[level];
+    for (int y = y0; y < y1; ++y) {
+        Vec2 row = multiply_affine_vec2(p->ti, {0, (float)y});
+        RGBA* out = p->fb->data + y * p->fb->w;
+        for (int x = x0; x < x1; x += simd_width) {
+            f32x8 px = lane + (float)x;
+            f32x8 wx = row.x + px * step.x;
+            f32x8 wy = row.y + px * step.y;
+            i32x8 inside = (wx >= 0) & (wy >= 0) & (wx < (float)world_x) & (wy < (float)world_y) &
+                           (px < (float)x1);
+
+            u32x8 lit_packed = {};
+            u32x8 albedo_packed = {};
+            u32x8 normal_packed = {};
+            f32x8 torch = {};
+            for (int l = 0; l < simd_width; ++l) {
+                if (!inside[l]) continue;
+                int xy = ((int)wy[l] >> level) * level_w + ((int)wx[l] >> level);
+                lit_packed[l] = lit[xy];
+                albedo_packed[l] = albedo[xy];
+                if (has_lights) normal_packed[l] = normal[xy];
+                torch[l] = torch_buffer[y * view.res_x + x + l];
+            }
+            f32x8 indirect_r, indirect_g, indirect_b;
+            indirect_sample8(wx, wy, &indirect_r, &indirect_g, &indirect_b);
+
+            // Cached sun and ambient light, plus the torch and lights that can change every frame
+            f32x8 r, g, b, albedo_r, albedo_g, albedo_b;
+            albedo_decode8(lit_packed, &r, &g, &b);
+            albedo_decode8(albedo_packed, &albedo_r, &albedo_g, &albedo_b);
+            f32x8 light_r = torch + indirect_r, light_g = torch + indirect_g, light_b = torch + indirect_b;
+            if (has_lights) accumulate_lights(tile, wx, wy, normal_packed, &light_r, &light_g, &light_b);
+            r = f32x8_clamp(r + light_r * albedo_r, 0, 1);
+            g = f32x8_clamp(g + light_g * albedo_g, 0, 1);
+            b = f32x8_clamp(b + light_b * albedo_b, 0, 1);
+
+            // Outside the world is cleared, the scene buffer isn't cleared between frames
+            int lanes = std::min(simd_width, x1 - x);
+            for (int l = 0; l < lanes; ++l) {
+                out[x + l] = inside[l] ? RGBA{r[l], g[l], b[l], 1} : RGBA{};
+            }
+        }
+    }
+    draw_shapes_tile(p, tile, x0, y0, x1, y1, &scenery_bins, scenery_visible, scenery.position, scenery.shape);
+
+    // Fog of war from the sight masks, entities out of sight aren't drawn at all
+    for (int y = y0; y < y1; ++y) {
+        Vec2 row = multiply_affine_vec2(p->ti, {0, (float)y});
+        RGBA* out = p->fb->data + y * p->fb->w;
+        for (int x = x0; x < x1; ++x) {
+            int wx = (int)(row.x + x * step.x);
+            int wy = (int)(row.y + x * step.y);
+            if (wx < 0 || wy < 0 || wx >= world_x || wy >= world_y) continue;
+            int i = wy * world_x + wx;
+            if (!sight.visible[i]) out[x] = rgba_scale(out[x], sight.explored[i] ? sight_explored_light : 0);
+        }
+    }
+    draw_shapes_tile(p, tile, x0, y0, x1, y1, &entity_bins, entity_seen, position, shape);
+}
+
+// Fills entity_seen with the entities on a visible cell, the player always
+int entity_gather_seen() {
+    int player = entity_index(&entities, controlling);
+    int n = 0;
+    for (int i = 0; i < entities.n; ++i) {
+        if (i != player && !fov_visible(&sight, (int)floorf(position[i].x), (int)floorf(position[i].y))) continue;
+        if (n == entity_seen_capacity) {
+            entity_seen_capacity = std::max(64, 2 * entity_seen_capacity);
+            entity_seen = (int*)realloc(entity_seen, entity_seen_capacity * sizeof(int));
+            entity_seen_circle = (Circle*)realloc(entity_seen_circle, entity_seen_capacity * sizeof(Circle));
+        }
+        entity_seen[n] = i;
+        entity_seen_circle[n++] = {position[i], shape[i].radius};
+    }
+    return n;
+}
+
+// Fills scenery_visible with the scenery in view
+int scenery_gather_visible() {
+    Vec2 margin = {scenery_max_radius + 1, scenery_max_radius + 1};
+    Vec2 min = view.position - margin;
+    Vec2 max = view.position + Vec2{view.size_x, view.size_y} + margin;
+    int n = 0;
+    scenery_for_each(min, max, [&](int i) {
+        if (n == scenery_visible_capacity) {
+            scenery_visible_capacity = std::max(1024, 2 * scenery_visible_capacity);
+            scenery_visible = (int*)realloc(scenery_visible, scenery_visible_capacity * sizeof(int));
+            scenery_visible_circle = (Circle*)realloc(scenery_visible_circle, scenery_visible_capacity * sizeof(Circle));
+        }
+        scenery_visible[n] = i;
+        scenery_visible_circle[n++] = {scenery.position[i], scenery.shape[i].radius};
+    });
+    return n;
+}
+
+// Bilinear upscale of the scene into framebuffer rows [task * 16, task * 16 + 16)
+void upscale_rows(int task, void* data) {
+    Img* fb = (Img*)data;
+    Img* scene = &dynamic_resolution.scene;
+    float sx = (float)scene->w / fb->w;
+    float sy = (float)scene->h / fb->h;
+    int y1 = std::min(task * 16 + 16, fb->h);
+    for (int y = task * 16; y < y1; ++y) {
+        float v = clampf((y + 0.5f) * sy - 0.5f, 0, scene->h - 1);
+        int v0 = (int)v;
+        int v1 = std::min(v0 + 1, scene->h - 1);
+        float fv = v - v0;
+        RGBA* row0 = scene->data + v0 * scene->w;
+        RGBA* row1 = scene->data + v1 * scene->w;
+        RGBA* out = fb->data + y * fb->w;
+        for (int x = 0; x < fb->w; ++x) {
+            float u = clampf((x + 0.5f) * sx - 0.5f, 0, scene->w - 1);
+            int u0 = (int)u;
+            int u1 = std::min(u0 + 1, scene->w - 1);
+            float fu = u - u0;
+            RGBA top = rgba_add(rgba_scale(row0[u0], 1 - fu), rgba_scale(row0[u1], fu));
+            RGBA bottom = rgba_add(rgba_scale(row1[u0], 1 - fu), rgba_scale(row1[u1], fu));
+            out[x] = rgba_add(rgba_scale(top, 1 - fv), rgba_scale(bottom, fv));
+        }
+    }
+}
+
+void dynamic_resolution_update(float shading_ms) {
+    DynamicResolution* d = &dynamic_resolution;
+    d->smoothed_ms = d->smoothed_ms == 0 ? shading_ms : 0.9f * d->smoothed_ms + 0.1f * shading_ms;
+
+    float wanted = d->scale * sqrtf(d->target_ms / fmaxf(d->smoothed_ms, 0.01f));
+    // Small steps, and ignore small errors so the resolution doesn't flicker
+    if (fabsf(wanted - d->scale) > 0.02f) {
+        d->scale = clampf(d->scale + clampf(wanted - d->scale, -0.05f, 0.05f), d->min_scale, 1);
+    }
+}
+
+float world_render_scale() {
+    return dynamic_resolution.scale;
+}
+
+void world_draw() {
+    // render_ground();
+    // gfx_draw_sprite(&ground_sprite, t, false);
+
+    Img* fb = gfx_get_framebuffer();
+    DynamicResolution* d = &dynamic_resolution;
+    int res_x = std::max(1, (int)(camera.res_x * d->scale));
+    int res_y = std::max(1, (int)(camera.res_y * d->scale));
+    if (res_x != view.res_x || res_y != view.res_y) {
+        // The torch buffer stride changes with the resolution
+        memset(torch_buffer, 0, camera.res_x * camera.res_y * sizeof(float));
+        torch_lit = {};
+    }
+    view = camera;
+    view.res_x = res_x;
+    view.res_y = res_y;
+    d->scene.w = res_x;
+    d->scene.h = res_y;
+    bool full_resolution = res_x == camera.res_x && res_y == camera.res_y;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    torch_light_pass();
+    light_cache_update();
+    indirect_update();
+
+    RGB sun_rgb = kelvin_to_color(sun_temperature_from_angle(sun.angle));
+    float sun_height = fmaxf(sinf(sun.angle), 0);
+    ShadeParams params = {
+        .t = view.view_transform(),
+        .ti = inverse(view.view_transform()),
+        .fb = full_resolution ? fb : &d->scene,
+        .tiles_x = (view.res_x + draw_tile_size - 1) / draw_tile_size,
+        // The finest level with at most one texel per pixel
+        .level = clampi((int)ceilf(log2f(view.size_x / view.res_x)), 0, ground_mip_levels - 1),
+        .entity_light = vec3_add(ambient_light, vec3_scale({sun_rgb.r, sun_rgb.g, sun_rgb.b}, sun_height)),
+    };
+    int tiles_y = (view.res_y + draw_tile_size - 1) / draw_tile_size;
+    for (int i = 0; i < light_slots.n; ++i) light_circle[i] = {lights[i].position, lights[i].radius};
+    tile_bins_build(&light_bins, light_circle, light_slots.n, 0, params.t, params.tiles_x, tiles_y);
+    int n_seen = entity_gather_seen();
+    tile_bins_build(&entity_bins, entity_seen_circle, n_seen, params.ti.m.m00, params.t, params.tiles_x, tiles_y);
+    int n_visible = scenery_gather_visible();
+    tile_bins_build(&scenery_bins, scenery_visible_circle, n_visible, params.ti.m.m00, params.t, params.tiles_x, tiles_y);
+    thread_pool_run(params.tiles_x * tiles_y, world_shade_tile, &params);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    dynamic_resolution_update(std::chrono::duration<float, std::milli>(end - start).count());
+
+    if (!full_resolution) thread_pool_run((fb->h + 15) / 16, upscale_rows, fb);
 }
 
 void world_key_input(int action, int key) {
@@ -541,6 +2690,7 @@ void world_key_input(int action, int key) {
             case GLFW_KEY_D: controls.right = true; break;
             case GLFW_KEY_W: controls.up = true; break;
             case GLFW_KEY_S: controls.down = true; break;
+            case GLFW_KEY_F5: world_snapshot_save(world_snapshot_path); break;
         }
 
     } else if (action == GLFW_RELEASE) {
@@ -562,13 +2712,24 @@ void world_mouse_button(int button, int action) {
         Affine t = inverse(camera.view_transform());
         Vec2 p = multiply_affine_vec2(t, controls.mouse);
 
-        int world_xy = (int)p.y * world_x + (int)p.x;
-        if (ground.mat[world_xy] == WATER) {
+        if (ground_at((int)p.x, (int)p.y) == WATER) {
             // water_touch(p);
         } else {
-            // ground_add_more(p);
+            ground_add_more(p);
         }
     }
+    if (button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_PRESS) {
+        ground_pour_water(multiply_affine_vec2(inverse(camera.view_transform()), controls.mouse));
+    }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && ground_paths.clusters) {
+        Affine t = inverse(camera.view_transform());
+        Vec2 p = multiply_affine_vec2(t, controls.mouse);
+        Vec2 from = position[entity_index(&entities, controlling)];
+        int n = hpa_find_path(&ground_paths, {(int)from.x, (int)from.y}, {(int)p.x, (int)p.y}, player_path,
+                              max_player_path);
+        player_path_n = clampi(n, 0, max_player_path);
+        player_path_next = 1;
+    }
 }
 
 void world_scroll_input(float xoffset, float yoffset) {
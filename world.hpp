@@ -1,12 +1,14 @@
 #ifndef WORLD_HPP
 #define WORLD_HPP
 
-void world_init();
+// World of size_x by size_y cells, the ground is stored sparsely so it can be large
+void world_init(int size_x, int size_y);
 void world_key_input(int action, int key);
 void world_mouse_cursor_position(float xpos, float ypos);
 void world_mouse_button(int button, int action);
 void world_scroll_input(float xoffset, float yoffset);
 void world_update(float dt);
 void world_draw();
+float world_render_scale();
 
 #endif /* WORLD_HPP */
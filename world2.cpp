@@ -1,6 +1,7 @@
 #include <GL/glu.h>
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <algorithm>
 #include <cstdlib>
 
 #include "gfx.hpp"
@@ -22,6 +23,7 @@ ItemType type[grid_size];
 float height[grid_size];
 Vec3 albedo[grid_size];
 bool shadow[grid_size];
+Vec3 normal[grid_size];
 
 Vec3 item_albedo[10];
 float sun_angle;
@@ -34,6 +36,42 @@ const int window_width = 1024;
 const int window_height = 1024;
 bool running = true;
 
+// Grid cells [x0, x1) x [y0, y1)
+struct GridRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+
+    bool empty() { return x0 >= x1 || y0 >= y1; }
+    int area() { return empty() ? 0 : (x1 - x0) * (y1 - y0); }
+};
+
+enum BrushMode {
+    BRUSH_RAISE,
+    BRUSH_LOWER,
+    BRUSH_FLATTEN,
+};
+
+struct Brush {
+    BrushMode mode = BRUSH_RAISE;
+    float radius = 5;
+    float strength = 1;
+    float flatten_height = 0;
+};
+
+// Number of cells recomputed by the last terrain update
+struct TerrainUpdateStats {
+    int heights = 0;
+    int normals = 0;
+    int albedo = 0;
+    int shadows = 0;
+};
+
+GridRect dirty;
+Brush brush;
+Vec2 mouse;
+
 Vec3 rgba_to_vec3(RGBA c) {
     return {c.r, c.g, c.b};
 }
@@ -101,22 +139,69 @@ Vec3 kelvin_to_color(float t) {
     return vec3_clamp(vec3_div({red, green, blue}, 255.f), 0, 1);
 }
 
+GridRect rect_full() {
+    return {0, 0, grid_w, grid_h};
+}
+
+GridRect rect_union(GridRect a, GridRect b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    return {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+}
+
+GridRect rect_clip(GridRect r) {
+    return {std::max(r.x0, 0), std::max(r.y0, 0), std::min(r.x1, grid_w), std::min(r.y1, grid_h)};
+}
+
+GridRect rect_grow(GridRect r, int margin) {
+    return rect_clip({r.x0 - margin, r.y0 - margin, r.x1 + margin, r.y1 + margin});
+}
+
+float height_at(int x, int y) {
+    x = clampi(x, 0, grid_w - 1);
+    y = clampi(y, 0, grid_h - 1);
+    return height[y * grid_w + x];
+}
+
+int update_normals(GridRect r) {
+    for (int y = r.y0; y < r.y1; ++y)
+        for (int x = r.x0; x < r.x1; ++x) {
+            // Central differences, cells are one unit apart
+            float dx = (height_at(x + 1, y) - height_at(x - 1, y)) / 2;
+            float dy = (height_at(x, y + 1) - height_at(x, y - 1)) / 2;
+            normal[y * grid_w + x] = vec3_normalize({-dx, -dy, 1});
+        }
+    return r.area();
+}
+
+int pre_rendering(GridRect r) {
+    float height_range = 50;
+    for (int y = r.y0; y < r.y1; ++y)
+        for (int x = r.x0; x < r.x1; ++x) {
+            int i = y * grid_w + x;
+            float height_color_scale = fmin(10, fmax(0, 1 + (height[i] / height_range)));
+            albedo[i] = vec3_scale(item_albedo[type[i]], height_color_scale);
+        }
+    return r.area();
+}
+
 void init() {
     for (int i = 0; i < grid_size; ++i) {
         type[i] = GRASS;
         height[i] = 0;
     }
 
-    // TODO: make with multiple octaves
-    float* perlin = create_perlin_grid(grid_h, grid_w, 0.1);
+    FbmParams params = {.octaves = 5, .frequency = 0.05};
+    fbm_fill(height, grid_w, grid_h, 0, 0, params);
     for (int i = 0; i < grid_size; ++i) {
-        printf("%.2f\n", perlin[i]);
-        height[i] = perlin[i] * 8;
+        height[i] *= 8;
     }
-    free(perlin);
 
     item_albedo[GRASS] = rgba_to_vec3(rgba_from_hex(0x606c38));
     item_albedo[WATER] = rgba_to_vec3(rgba_from_hex(0x457b9d));
+
+    update_normals(rect_full());
+    pre_rendering(rect_full());
 }
 
 struct Ray {
@@ -124,16 +209,27 @@ struct Ray {
     Vec3 direction;
 };
 
-bool is_occluded(Vec3 light_pos, Vec3 point_pos) {
+void terrain_height_range(float* min_height, float* max_height) {
+    *min_height = height[0];
+    *max_height = height[0];
+    for (int i = 1; i < grid_size; ++i) {
+        *max_height = fmax(*max_height, height[i]);
+        *min_height = fmin(*min_height, height[i]);
+    }
+}
+
+// Marches from the point towards a sun infinitely far away, so every ray is parallel to sun_vec.
+// Past max_height nothing can block it any more.
+bool is_occluded(Vec3 sun_vec, Vec3 point_pos, float max_height) {
     Ray ray = {
         .origin = point_pos,
-        .direction = vec3_normalize(vec3_sub(light_pos, point_pos)),
+        .direction = sun_vec,
     };
 
     float step_size = 2;
     Vec3 step = vec3_scale(ray.direction, step_size);
 
-    while (vec3_norm(vec3_sub(ray.origin, light_pos)) > 1) {
+    while (ray.origin.z <= max_height) {
         Vec3 p = vec3_add(ray.origin, step);
 
         int x = p.x;
@@ -152,20 +248,85 @@ bool is_occluded(Vec3 light_pos, Vec3 point_pos) {
     return false;
 }
 
-void update_shadow_map() {
+int update_shadow_map(GridRect r) {
     Vec3 sun_vec = {cos(sun_angle), 0, sin(sun_angle)};
-    Vec3 sun_pos_3d = vec3_scale(sun_vec, 1000);
-    for (int y = 0; y < grid_h; ++y)
-        for (int x = 0; x < grid_w; ++x) {
+    float min_height, max_height;
+    terrain_height_range(&min_height, &max_height);
+    for (int y = r.y0; y < r.y1; ++y)
+        for (int x = r.x0; x < r.x1; ++x) {
             int xy = y * grid_w + x;
 
             Vec3 point_3d = {(float)x, (float)y, height[xy]};
-            if (is_occluded(sun_pos_3d, point_3d)) {
+            if (is_occluded(sun_vec, point_3d, max_height)) {
                 shadow[xy] = true;
                 continue;
             }
             shadow[xy] = false;
         }
+    return r.area();
+}
+
+// Cells whose shadow ray towards the sun can cross the edited rectangle. The sun is directional
+// and only moves in the xz-plane, so rays stay in their row: these are the same rows, extended
+// away from the sun until the ray has climbed above the highest point of the grid.
+GridRect shadow_region_downwind(GridRect edit) {
+    float min_height, max_height;
+    terrain_height_range(&min_height, &max_height);
+
+    float sun_x = cos(sun_angle);
+    float sun_z = sin(sun_angle);
+    int reach = grid_w;
+    if (sun_z > 0 && fabs(sun_x) > 0) {
+        float slope = sun_z / fabs(sun_x);
+        reach = std::min(grid_w, (int)ceil((max_height - min_height) / slope) + 1);
+    }
+
+    GridRect r = edit;
+    if (sun_x >= 0) r.x0 -= reach;
+    if (sun_x <= 0) r.x1 += reach;
+    return rect_clip(r);
+}
+
+// Applies the brush around `center` (in grid cells) and marks the touched cells dirty
+int terrain_edit(Brush b, Vec2 center) {
+    GridRect r = rect_clip({
+        (int)floor(center.x - b.radius),
+        (int)floor(center.y - b.radius),
+        (int)ceil(center.x + b.radius) + 1,
+        (int)ceil(center.y + b.radius) + 1,
+    });
+
+    for (int y = r.y0; y < r.y1; ++y)
+        for (int x = r.x0; x < r.x1; ++x) {
+            float d = vec2_norm(Vec2{(float)x, (float)y} - center);
+            if (d >= b.radius) continue;
+
+            float t = d / b.radius;
+            float falloff = 1 - t * t * (3 - 2 * t);
+            float& h = height[y * grid_w + x];
+            switch (b.mode) {
+                case BRUSH_RAISE: h += b.strength * falloff; break;
+                case BRUSH_LOWER: h -= b.strength * falloff; break;
+                case BRUSH_FLATTEN: h += (b.flatten_height - h) * clampf(b.strength * falloff, 0, 1); break;
+            }
+        }
+
+    dirty = rect_union(dirty, r);
+    return r.area();
+}
+
+// Recomputes what depends on the heights in the dirty rectangle only
+TerrainUpdateStats terrain_update_dirty() {
+    TerrainUpdateStats stats;
+    if (dirty.empty()) return stats;
+
+    stats.heights = dirty.area();
+    // Normals use central differences so the ring around the edit changes too
+    stats.normals = update_normals(rect_grow(dirty, 1));
+    stats.albedo = pre_rendering(dirty);
+    stats.shadows = update_shadow_map(shadow_region_downwind(dirty));
+    dirty = {};
+    return stats;
 }
 
 void update(float dt) {
@@ -174,27 +335,18 @@ void update(float dt) {
 
     update_sun_angle();
 
-    if (period_update_shadow_map.passed(dt_ms)) {
-        update_shadow_map();
-    }
-}
+    // Edits first, the full shadow refresh doesn't redo their normals and albedo
+    if (!dirty.empty()) terrain_update_dirty();
 
-void pre_rendering() {
-    float height_range = 50;
-    for (int i = 0; i < grid_size; ++i) {
-        float height_color_scale = fmin(10, fmax(0, 1 + (height[i] / height_range)));
-        albedo[i] = vec3_scale(item_albedo[type[i]], height_color_scale);
+    if (period_update_shadow_map.passed(dt_ms)) {
+        update_shadow_map(rect_full());
     }
 }
 
 void draw(Img* fb) {
-    pre_rendering();
-
     Vec3 ambient_light = vec3_scale({1, 1, 1}, 0.3);
     Vec3 sun_vec = {cos(sun_angle), 0, sin(sun_angle)};
     Vec3 sun_color = kelvin_to_color(sun_temperature_from_angle(sun_angle));
-    Vec3 sun_pos_3d = vec3_scale(sun_vec, 1000);
-    Vec3 normal = {0, 0, 1};
     for (int y = 0; y < grid_h; ++y)
         for (int x = 0; x < grid_w; ++x) {
             int xy = y * grid_w + x;
@@ -202,7 +354,7 @@ void draw(Img* fb) {
 
             // Vec3 point_3d = {(float)x, (float)y, item.height};
             if (!shadow[xy]) {
-                float diffuse = fmax(0, vec3_dot(normal, sun_vec));
+                float diffuse = fmax(0, vec3_dot(normal[xy], sun_vec));
                 Vec3 sun_light = vec3_scale(sun_color, diffuse);
                 illumination = vec3_add(illumination, sun_light);
             }
@@ -221,6 +373,25 @@ void on_key_input(GLFWwindow* window, int key, int scancode, int action, int mod
     }
 }
 
+void on_mouse_move(GLFWwindow* window, double xpos, double ypos) {
+    mouse = {(float)xpos * grid_w / window_width, (float)ypos * grid_h / window_height};
+}
+
+void on_mouse_click(GLFWwindow* window, int button, int action, int mods) {
+    if (action != GLFW_PRESS) return;
+
+    switch (button) {
+        case GLFW_MOUSE_BUTTON_LEFT: brush.mode = BRUSH_RAISE; break;
+        case GLFW_MOUSE_BUTTON_RIGHT: brush.mode = BRUSH_LOWER; break;
+        case GLFW_MOUSE_BUTTON_MIDDLE:
+            brush.mode = BRUSH_FLATTEN;
+            brush.flatten_height = height_at(mouse.x, mouse.y);
+            break;
+        default: return;
+    }
+    terrain_edit(brush, mouse);
+}
+
 int main(int argc, char** argv) {
     std::srand(std::time(0));
 
@@ -241,8 +412,8 @@ int main(int argc, char** argv) {
     timer_dt.start();
 
     glfwSetKeyCallback(window, on_key_input);
-    // glfwSetCursorPosCallback(window, on_mouse_move);
-    // glfwSetMouseButtonCallback(window, on_mouse_click);
+    glfwSetCursorPosCallback(window, on_mouse_move);
+    glfwSetMouseButtonCallback(window, on_mouse_click);
     // glfwSetScrollCallback(window, portal2d_mouse_button);
 
     gfx_init(grid_w, grid_h);